@@ -21,11 +21,33 @@
 #include <limits>
 #include <algorithm>
 #include <fstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <array>
+#include <string>
+#include <filesystem>
+#include <cstdio>
+#include <functional>
+#include <cmath>
 
 // Window width & height
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
+// How many frames the CPU can record ahead of the GPU
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
+// Space for per-draw uniform data in each frame
+const VkDeviceSize UNIFORM_BYTES_PER_FRAME = 256 * 1024;
+
+// Per-draw uniform block, set 0 binding 0 (a dynamic uniform buffer)
+struct ObjectUniforms {
+    float model[4][4]; // column major, like GLSL
+};
+
 // All the validation layers we want
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -62,6 +84,17 @@ std::vector<const char*> getRequiredExtensions() {
     return extensions;
 }
 
+// Highest API version the loader supports (vkEnumerateInstanceVersion doesn't exist on 1.0 loaders)
+uint32_t getInstanceVersion() {
+    auto func = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+
+    uint32_t version = VK_API_VERSION_1_0;
+    if (func != nullptr) {
+        func(&version);
+    }
+    return version;
+}
+
 // Checks if all the validation layers we want to use are available
 bool checkValidationLayerSupport() {
     uint32_t layerCount;
@@ -104,66 +137,2058 @@ VkResult CreateDebugUtilsMessengerEXT(
     }
 }
 
-// Callback for processing errors/warnings/debug info however you want
-VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-    VkDebugUtilsMessageTypeFlagsEXT messageType,
-    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
-    void *pUserData
-) {
-    std::cerr << "validation layer: " << pCallbackData->pMessage <<  std::endl;
+// Callback for processing errors/warnings/debug info however you want
+VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT messageType,
+    const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
+    void *pUserData
+) {
+    std::cerr << "validation layer: " << pCallbackData->pMessage <<  std::endl;
+
+    return VK_FALSE;
+}
+
+// Initialize debug messenger to be used for createInstance and destroyInstance
+// since the normal debug messenger works only on a valid instance.
+void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
+    createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity = 
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | 
+        VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+
+    createInfo.messageType = 
+        VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+        VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+        VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    createInfo.pfnUserCallback = debugCallback;
+}
+
+// Load the destructor extension for the debugutils messenger and destroy that shit
+void DestroyDebugUtilsMessengerEXT(
+    VkInstance instance,
+    VkDebugUtilsMessengerEXT debugMessenger,
+    const VkAllocationCallbacks *pAllocator) {
+
+    auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) 
+        vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+
+    if (func != nullptr) {
+        func(instance, debugMessenger, pAllocator);
+    }
+}
+
+// Find a memory type that's allowed by typeFilter and has all the properties we want
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+// Layout transition + memory dependency for a single-mip, single-layer color image
+void recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                        VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage,
+                        VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+
+// Class/struct definitions
+// =======================================================
+struct QueueFamilyIndices {
+    std::optional<uint32_t> graphicsFamily; // supported graphics device queue families
+    std::optional<uint32_t> presentFamily; // supported presentation queue families
+    
+
+    bool isComplete() {
+        return graphicsFamily.has_value() && presentFamily.has_value();
+    }
+};
+
+struct SwapChainSupportDetails {
+    VkSurfaceCapabilitiesKHR capabilities;
+    std::vector<VkSurfaceFormatKHR> formats;
+    std::vector<VkPresentModeKHR> presentModes;
+};
+
+
+// Host memory allocator for the driver (VkAllocationCallbacks)
+// =======================================================
+
+// Which create/destroy call an allocation came from. Each tag gets its own
+// VkAllocationCallbacks so the stats can be split per object type.
+enum class AllocationTag : uint8_t {
+    Instance,
+    DebugMessenger,
+    Surface,
+    Device,
+    Swapchain,
+    ImageView,
+    ShaderModule,
+    CommandPool,
+    Semaphore,
+    Fence,
+    Buffer,
+    DeviceMemory,
+    Image,
+    RenderPass,
+    Framebuffer,
+    QueryPool,
+    PipelineLayout,
+    Pipeline,
+    DescriptorSetLayout,
+    DescriptorPool,
+    Count
+};
+
+const char *allocationTagName(AllocationTag tag) {
+    switch (tag) {
+        case AllocationTag::Instance:       return "instance";
+        case AllocationTag::DebugMessenger: return "debug messenger";
+        case AllocationTag::Surface:        return "surface";
+        case AllocationTag::Device:         return "device";
+        case AllocationTag::Swapchain:      return "swapchain";
+        case AllocationTag::ImageView:      return "image view";
+        case AllocationTag::ShaderModule:   return "shader module";
+        case AllocationTag::CommandPool:    return "command pool";
+        case AllocationTag::Semaphore:      return "semaphore";
+        case AllocationTag::Fence:          return "fence";
+        case AllocationTag::Buffer:         return "buffer";
+        case AllocationTag::DeviceMemory:   return "device memory";
+        case AllocationTag::Image:          return "image";
+        case AllocationTag::RenderPass:     return "render pass";
+        case AllocationTag::Framebuffer:    return "framebuffer";
+        case AllocationTag::QueryPool:      return "query pool";
+        case AllocationTag::PipelineLayout: return "pipeline layout";
+        case AllocationTag::Pipeline:       return "pipeline";
+        case AllocationTag::DescriptorSetLayout: return "descriptor set layout";
+        case AllocationTag::DescriptorPool: return "descriptor pool";
+        default:                            return "unknown";
+    }
+}
+
+const char *allocationScopeName(uint32_t scope) {
+    switch (scope) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:  return "command";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:   return "object";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:    return "cache";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:   return "device";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+        default:                                  return "unknown";
+    }
+}
+
+// Counters for one (object type, allocation scope) pair
+struct AllocationScopeStats {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> reallocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> poolHits{0}; // served from a thread cache or the shared pool
+    std::atomic<uint64_t> poolMisses{0}; // had to go to malloc
+    std::atomic<uint64_t> internalAllocations{0}; // driver-reported (e.g. executable memory)
+    std::atomic<uint64_t> internalFrees{0};
+    std::atomic<int64_t> liveBytes{0};
+    std::atomic<int64_t> peakBytes{0};
+    std::atomic<int64_t> internalLiveBytes{0}; // driver's own memory, not served by us
+    std::atomic<int64_t> internalPeakBytes{0};
+};
+
+// Totals over every object type and scope at one point in time. Diffing two
+// of them gives the traffic of whatever ran in between.
+struct HostAllocationCounts {
+    uint64_t allocations = 0;
+    uint64_t reallocations = 0;
+    uint64_t frees = 0;
+    uint64_t poolMisses = 0;
+    uint64_t internalAllocations = 0;
+};
+
+// Small allocations are rounded up to power-of-two size classes. Freed blocks
+// go to a per-thread cache first and spill into a shared pool, so once the
+// driver has warmed up its allocations stop hitting malloc altogether.
+// Anything bigger than the largest class goes straight to malloc.
+class HostAllocator {
+    public:
+        static constexpr uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+        static constexpr uint32_t TAG_COUNT = static_cast<uint32_t>(AllocationTag::Count);
+
+        HostAllocator() {
+            for (uint32_t i = 0; i < TAG_COUNT; i++) {
+                TagState &state = tags[i];
+                state.owner = this;
+                state.tag = static_cast<AllocationTag>(i);
+                state.callbacks.pUserData = &state;
+                state.callbacks.pfnAllocation = allocationCallback;
+                state.callbacks.pfnReallocation = reallocationCallback;
+                state.callbacks.pfnFree = freeCallback;
+                state.callbacks.pfnInternalAllocation = internalAllocationCallback;
+                state.callbacks.pfnInternalFree = internalFreeCallback;
+            }
+        }
+
+        ~HostAllocator() {
+            for (auto &pool : pools) {
+                for (void *block : pool.blocks) {
+                    std::free(block);
+                }
+            }
+        }
+
+        HostAllocator(const HostAllocator&) = delete;
+        HostAllocator &operator=(const HostAllocator&) = delete;
+
+        // Callbacks to pass as pAllocator. Create and destroy of the same
+        // object must use the same tag.
+        const VkAllocationCallbacks *callbacks(AllocationTag tag) const {
+            return &tags[static_cast<uint32_t>(tag)].callbacks;
+        }
+
+        const AllocationScopeStats &stats(AllocationTag tag, VkSystemAllocationScope scope) const {
+            return tags[static_cast<uint32_t>(tag)].scopes[scope];
+        }
+
+        HostAllocationCounts counts() const {
+            HostAllocationCounts total;
+            for (const TagState &state : tags) {
+                for (const AllocationScopeStats &s : state.scopes) {
+                    total.allocations += s.allocations;
+                    total.reallocations += s.reallocations;
+                    total.frees += s.frees;
+                    total.poolMisses += s.poolMisses;
+                    total.internalAllocations += s.internalAllocations;
+                }
+            }
+            return total;
+        }
+
+        // Traffic since an earlier counts(), in total and averaged over frames
+        void printSince(std::ostream &out, const char *label, const HostAllocationCounts &since, uint64_t frames) const {
+            HostAllocationCounts now = counts();
+            uint64_t allocations = now.allocations - since.allocations;
+            uint64_t reallocations = now.reallocations - since.reallocations;
+            uint64_t frees = now.frees - since.frees;
+            uint64_t poolMisses = now.poolMisses - since.poolMisses;
+            uint64_t internalAllocations = now.internalAllocations - since.internalAllocations;
+            double perFrame = frames > 0 ? 1.0 / static_cast<double>(frames) : 0.0;
+
+            out << "host allocations during " << label << " (" << frames << " frames): "
+                << allocations << " allocs, " << reallocations << " reallocs, " << frees << " frees, "
+                << poolMisses << " malloc calls, " << internalAllocations << " internal allocs" << std::endl;
+            out << "  per frame: " << allocations * perFrame << " allocs, " << reallocations * perFrame << " reallocs, "
+                << frees * perFrame << " frees, " << poolMisses * perFrame << " malloc calls, "
+                << internalAllocations * perFrame << " internal allocs" << std::endl;
+        }
+
+        // Dump one row per (object type, scope) that saw any traffic, then per-scope totals
+        void printStats(std::ostream &out) const {
+            uint64_t totalAllocations[SCOPE_COUNT] = {};
+            uint64_t totalHits[SCOPE_COUNT] = {};
+
+            out << "host allocations (object type / scope: allocs, reallocs, frees, pool hits, peak bytes, live bytes)" << std::endl;
+            for (const TagState &state : tags) {
+                for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++) {
+                    const AllocationScopeStats &s = state.scopes[scope];
+                    if (s.allocations == 0 && s.internalAllocations == 0) continue;
+
+                    out << "  " << allocationTagName(state.tag) << " / " << allocationScopeName(scope) << ": "
+                        << s.allocations << ", " << s.reallocations << ", " << s.frees << ", "
+                        << s.poolHits << ", " << s.peakBytes << ", " << s.liveBytes;
+                    if (s.internalAllocations > 0) {
+                        out << " (+" << s.internalAllocations << " internal allocs, " << s.internalFrees << " frees, "
+                            << s.internalPeakBytes << " peak bytes, " << s.internalLiveBytes << " live bytes)";
+                    }
+                    out << std::endl;
+
+                    totalAllocations[scope] += s.allocations;
+                    totalHits[scope] += s.poolHits;
+                }
+            }
+
+            for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++) {
+                if (totalAllocations[scope] == 0) continue;
+                out << "  total / " << allocationScopeName(scope) << ": "
+                    << totalAllocations[scope] << " allocs, "
+                    << totalHits[scope] << " pool hits, "
+                    << scopeTotals[scope].peakBytes << " peak bytes, "
+                    << scopeTotals[scope].liveBytes << " live bytes" << std::endl;
+            }
+        }
+
+    private:
+        // Size classes are 64 bytes .. 16 KiB
+        static constexpr uint32_t MIN_CLASS_SHIFT = 6;
+        static constexpr uint32_t MAX_CLASS_SHIFT = 14;
+        static constexpr uint32_t CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+        static constexpr uint8_t LARGE_CLASS = 0xff;
+
+        // Blocks each thread keeps for itself before spilling half into the shared pool
+        static constexpr uint32_t THREAD_CACHE_SIZE = 32;
+
+        // Sits right in front of every pointer we hand to the driver
+        struct alignas(16) BlockHeader {
+            uint64_t size; // bytes the driver asked for
+            uint32_t offset; // distance from the start of the block to the user pointer
+            uint8_t sizeClass;
+            uint8_t scope;
+            uint8_t tag;
+            uint8_t pad;
+        };
+        static_assert(sizeof(BlockHeader) == 16, "block header must stay 16 bytes");
+
+        struct TagState {
+            HostAllocator *owner = nullptr;
+            AllocationTag tag = AllocationTag::Instance;
+            VkAllocationCallbacks callbacks{};
+            AllocationScopeStats scopes[SCOPE_COUNT];
+        };
+
+        // Live/peak bytes of a scope summed over every object type, so the
+        // peak is that of the total rather than a sum of per-type peaks
+        struct ScopeTotals {
+            std::atomic<int64_t> liveBytes{0};
+            std::atomic<int64_t> peakBytes{0};
+        };
+
+        struct SharedPool {
+            std::mutex mutex;
+            std::vector<void*> blocks;
+        };
+
+        // Blocks are plain malloc'd memory of the class size, so a thread cache
+        // doesn't care which allocator they came from.
+        struct ThreadCache {
+            void *blocks[CLASS_COUNT][THREAD_CACHE_SIZE];
+            uint32_t count[CLASS_COUNT] = {};
+
+            ~ThreadCache() {
+                for (uint32_t c = 0; c < CLASS_COUNT; c++) {
+                    for (uint32_t i = 0; i < count[c]; i++) {
+                        std::free(blocks[c][i]);
+                    }
+                }
+            }
+        };
+
+        static thread_local ThreadCache threadCache;
+
+        TagState tags[TAG_COUNT];
+        ScopeTotals scopeTotals[SCOPE_COUNT];
+        SharedPool pools[CLASS_COUNT];
+
+        static size_t classSize(uint32_t sizeClass) {
+            return size_t(1) << (sizeClass + MIN_CLASS_SHIFT);
+        }
+
+        static uint8_t sizeClassFor(size_t blockSize) {
+            uint32_t shift = MIN_CLASS_SHIFT;
+            while ((size_t(1) << shift) < blockSize) {
+                if (++shift > MAX_CLASS_SHIFT) return LARGE_CLASS;
+            }
+            return static_cast<uint8_t>(shift - MIN_CLASS_SHIFT);
+        }
+
+        static BlockHeader *headerOf(void *pMemory) {
+            return reinterpret_cast<BlockHeader*>(pMemory) - 1;
+        }
+
+        // Grab a block of the given class, thread cache first, then the shared pool
+        void *popBlock(uint8_t sizeClass) {
+            ThreadCache &cache = threadCache;
+            uint32_t &count = cache.count[sizeClass];
+
+            if (count == 0) {
+                // Refill up to half the cache in one go to keep lock traffic down
+                SharedPool &pool = pools[sizeClass];
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                while (count < THREAD_CACHE_SIZE / 2 && !pool.blocks.empty()) {
+                    cache.blocks[sizeClass][count++] = pool.blocks.back();
+                    pool.blocks.pop_back();
+                }
+            }
+
+            if (count == 0) return nullptr;
+            return cache.blocks[sizeClass][--count];
+        }
+
+        void pushBlock(uint8_t sizeClass, void *block) {
+            ThreadCache &cache = threadCache;
+            uint32_t &count = cache.count[sizeClass];
+
+            if (count == THREAD_CACHE_SIZE) {
+                SharedPool &pool = pools[sizeClass];
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                while (count > THREAD_CACHE_SIZE / 2) {
+                    pool.blocks.push_back(cache.blocks[sizeClass][--count]);
+                }
+            }
+
+            cache.blocks[sizeClass][count++] = block;
+        }
+
+        void *allocate(TagState &state, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            if (size == 0) return nullptr;
+
+            // malloc hands back 16 byte aligned memory, so padding by the
+            // alignment always leaves room for the header in front
+            alignment = std::max(alignment, alignof(BlockHeader));
+            size_t blockSize = size + alignment;
+
+            AllocationScopeStats &stats = state.scopes[scope];
+            uint8_t sizeClass = sizeClassFor(blockSize);
+            void *block = nullptr;
+
+            if (sizeClass != LARGE_CLASS) {
+                block = popBlock(sizeClass);
+                if (block != nullptr) {
+                    stats.poolHits++;
+                }
+                else {
+                    block = std::malloc(classSize(sizeClass));
+                    stats.poolMisses++;
+                }
+            }
+            else {
+                block = std::malloc(blockSize);
+                stats.poolMisses++;
+            }
+
+            if (block == nullptr) return nullptr;
+
+            uintptr_t start = reinterpret_cast<uintptr_t>(block);
+            uintptr_t user = (start + sizeof(BlockHeader) + alignment - 1) & ~(uintptr_t(alignment) - 1);
+
+            BlockHeader *header = headerOf(reinterpret_cast<void*>(user));
+            header->size = size;
+            header->offset = static_cast<uint32_t>(user - start);
+            header->sizeClass = sizeClass;
+            header->scope = static_cast<uint8_t>(scope);
+            header->tag = static_cast<uint8_t>(state.tag);
+            header->pad = 0;
+
+            stats.allocations++;
+            addLiveBytes(stats, scope, static_cast<int64_t>(size));
+
+            return reinterpret_cast<void*>(user);
+        }
+
+        void *reallocate(TagState &state, void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            if (pOriginal == nullptr) return allocate(state, size, alignment, scope);
+            if (size == 0) {
+                release(pOriginal);
+                return nullptr;
+            }
+
+            BlockHeader *header = headerOf(pOriginal);
+            AllocationScopeStats &stats = tags[header->tag].scopes[header->scope];
+
+            // Still fits in the block we already have (alignment can't change on realloc)
+            if (header->sizeClass != LARGE_CLASS && header->offset + size <= classSize(header->sizeClass)) {
+                addLiveBytes(stats, header->scope, static_cast<int64_t>(size) - static_cast<int64_t>(header->size));
+                header->size = size;
+                stats.reallocations++;
+                return pOriginal;
+            }
+
+            void *pMemory = allocate(state, size, alignment, scope);
+            if (pMemory == nullptr) return nullptr; // original stays valid
+
+            std::memcpy(pMemory, pOriginal, std::min<size_t>(size, header->size));
+            release(pOriginal);
+            state.scopes[scope].reallocations++;
+
+            return pMemory;
+        }
+
+        void release(void *pMemory) {
+            if (pMemory == nullptr) return;
+
+            BlockHeader *header = headerOf(pMemory);
+            AllocationScopeStats &stats = tags[header->tag].scopes[header->scope];
+            stats.frees++;
+            addLiveBytes(stats, header->scope, -static_cast<int64_t>(header->size));
+
+            void *block = static_cast<char*>(pMemory) - header->offset;
+            if (header->sizeClass == LARGE_CLASS) {
+                std::free(block);
+            }
+            else {
+                pushBlock(header->sizeClass, block);
+            }
+        }
+
+        void addLiveBytes(AllocationScopeStats &stats, uint32_t scope, int64_t delta) {
+            trackBytes(stats.liveBytes, stats.peakBytes, delta);
+            trackBytes(scopeTotals[scope].liveBytes, scopeTotals[scope].peakBytes, delta);
+        }
+
+        static void trackBytes(std::atomic<int64_t> &liveBytes, std::atomic<int64_t> &peakBytes, int64_t delta) {
+            int64_t live = liveBytes.fetch_add(delta) + delta;
+            int64_t peak = peakBytes.load();
+            while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+        }
+
+        // Trampolines the driver calls, pUserData is the TagState for the object type
+        static void *VKAPI_CALL allocationCallback(void *pUserData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            TagState *state = static_cast<TagState*>(pUserData);
+            return state->owner->allocate(*state, size, alignment, scope);
+        }
+
+        static void *VKAPI_CALL reallocationCallback(void *pUserData, void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            TagState *state = static_cast<TagState*>(pUserData);
+            return state->owner->reallocate(*state, pOriginal, size, alignment, scope);
+        }
+
+        static void VKAPI_CALL freeCallback(void *pUserData, void *pMemory) {
+            TagState *state = static_cast<TagState*>(pUserData);
+            state->owner->release(pMemory);
+        }
+
+        // Notifications only, the driver allocated (or freed) this memory itself
+        static void VKAPI_CALL internalAllocationCallback(void *pUserData, size_t size, VkInternalAllocationType /*allocationType*/, VkSystemAllocationScope scope) {
+            TagState *state = static_cast<TagState*>(pUserData);
+            AllocationScopeStats &stats = state->scopes[scope];
+            stats.internalAllocations++;
+            trackBytes(stats.internalLiveBytes, stats.internalPeakBytes, static_cast<int64_t>(size));
+        }
+
+        static void VKAPI_CALL internalFreeCallback(void *pUserData, size_t size, VkInternalAllocationType /*allocationType*/, VkSystemAllocationScope scope) {
+            TagState *state = static_cast<TagState*>(pUserData);
+            AllocationScopeStats &stats = state->scopes[scope];
+            stats.internalFrees++;
+            trackBytes(stats.internalLiveBytes, stats.internalPeakBytes, -static_cast<int64_t>(size));
+        }
+};
+
+thread_local HostAllocator::ThreadCache HostAllocator::threadCache;
+
+
+// Per-frame linear allocator for dynamic uniform data
+// =======================================================
+
+// One persistently mapped, host-visible buffer cut into a region per frame in
+// flight. Handing out uniform data is just bumping an offset in the current
+// frame's region, and the whole region is reset at once when the timeline
+// value that frame last signalled has completed. Everything is bound through a single
+// VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptor plus the dynamic offset.
+class FrameLinearAllocator {
+    public:
+        struct Allocation {
+            void *data = nullptr; // write the uniform data here
+            VkBuffer buffer = VK_NULL_HANDLE;
+            uint32_t dynamicOffset = 0; // pass to vkCmdBindDescriptorSets
+            VkDeviceSize size = 0;
+        };
+
+        void create(VkDevice device, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceLimits &limits,
+                    VkDeviceSize bytesPerFrame, uint32_t frameCount, const HostAllocator &hostAllocator) {
+            this->device = device;
+            this->pBufferAllocator = hostAllocator.callbacks(AllocationTag::Buffer);
+            this->pMemoryAllocator = hostAllocator.callbacks(AllocationTag::DeviceMemory);
+
+            // Every dynamic offset has to be a multiple of this
+            alignment = std::max<VkDeviceSize>(limits.minUniformBufferOffsetAlignment, 1);
+            maxRange = limits.maxUniformBufferRange;
+            frameSize = alignUp(bytesPerFrame, alignment);
+            frameOffsets.resize(frameCount);
+            for (uint32_t i = 0; i < frameCount; i++) {
+                frameOffsets[i] = i * frameSize;
+            }
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = frameSize * frameCount;
+            bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateBuffer(device, &bufferInfo, pBufferAllocator, &buffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create frame uniform buffer!");
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+            // Coherent so we never have to flush what the CPU wrote
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = memRequirements.size;
+            allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+            if (vkAllocateMemory(device, &allocInfo, pMemoryAllocator, &memory) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate frame uniform buffer memory!");
+            }
+
+            vkBindBufferMemory(device, buffer, memory, 0);
+
+            // Stays mapped for the lifetime of the buffer
+            if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&mapped)) != VK_SUCCESS) {
+                throw std::runtime_error("failed to map frame uniform buffer!");
+            }
+
+            beginFrame(0);
+        }
+
+        void destroy() {
+            if (device == VK_NULL_HANDLE) return;
+
+            vkUnmapMemory(device, memory);
+            vkDestroyBuffer(device, buffer, pBufferAllocator);
+            vkFreeMemory(device, memory, pMemoryAllocator);
+            device = VK_NULL_HANDLE;
+        }
+
+        // Only call once the GPU is done with this frame's last submit,
+        // everything handed out the last time this frame was used gets recycled
+        void beginFrame(uint32_t frame) {
+            frameStart = frameOffsets[frame];
+            head = frameStart;
+        }
+
+        Allocation allocate(VkDeviceSize size) {
+            VkDeviceSize offset = alignUp(head, alignment);
+            if (offset + size > frameStart + frameSize || size > maxRange) {
+                throw std::runtime_error("frame uniform allocator out of space!");
+            }
+
+            head = offset + size;
+            highWater = std::max(highWater, head - frameStart);
+
+            Allocation allocation;
+            allocation.data = mapped + offset;
+            allocation.buffer = buffer;
+            allocation.dynamicOffset = static_cast<uint32_t>(offset);
+            allocation.size = size;
+            return allocation;
+        }
+
+        // Copy a uniform struct in and get back where it landed
+        template<typename T>
+        Allocation push(const T &value) {
+            Allocation allocation = allocate(sizeof(T));
+            std::memcpy(allocation.data, &value, sizeof(T));
+            return allocation;
+        }
+
+        // For writing the dynamic uniform buffer descriptor. range is the
+        // biggest struct a single draw will read.
+        VkDescriptorBufferInfo descriptorInfo(VkDeviceSize range) const {
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = buffer;
+            bufferInfo.offset = 0;
+            bufferInfo.range = range;
+            return bufferInfo;
+        }
+
+        VkDeviceSize bytesUsed() const { return head - frameStart; }
+        VkDeviceSize highWaterMark() const { return highWater; }
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *pBufferAllocator = nullptr;
+        const VkAllocationCallbacks *pMemoryAllocator = nullptr;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        char *mapped = nullptr;
+
+        VkDeviceSize alignment = 1;
+        VkDeviceSize maxRange = 0;
+        VkDeviceSize frameSize = 0;
+        std::vector<VkDeviceSize> frameOffsets;
+        VkDeviceSize frameStart = 0;
+        VkDeviceSize head = 0;
+        VkDeviceSize highWater = 0;
+
+        static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+};
+
+
+// Frame capture (readback to disk)
+// =======================================================
+
+enum class CaptureFormat {
+    None,
+    Raw, // tightly packed pixels in the swap chain format
+    Png  // 8-bit RGBA PNG sequence
+};
+
+struct CaptureSettings {
+    CaptureFormat format = CaptureFormat::None;
+    std::string directory = "capture";
+};
+
+// BUDDY_CAPTURE=png|raw turns capture on, BUDDY_CAPTURE_DIR picks where frames go
+CaptureSettings captureSettingsFromEnvironment() {
+    CaptureSettings settings;
+
+    const char *format = std::getenv("BUDDY_CAPTURE");
+    if (format != nullptr) {
+        if (strcmp(format, "png") == 0) {
+            settings.format = CaptureFormat::Png;
+        }
+        else if (strcmp(format, "raw") == 0) {
+            settings.format = CaptureFormat::Raw;
+        }
+        else {
+            throw std::runtime_error("BUDDY_CAPTURE must be png or raw!");
+        }
+    }
+
+    const char *directory = std::getenv("BUDDY_CAPTURE_DIR");
+    if (directory != nullptr) {
+        settings.directory = directory;
+    }
+
+    return settings;
+}
+
+// CRC-32 as used by PNG chunks, chainable by passing the previous result back in
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Writes an RGBA8 PNG. The image data goes in uncompressed (stored deflate
+// blocks), so this is cheap enough to keep up with the render loop and needs
+// no zlib. scanlines is scratch space that gets reused between calls.
+void writePng(const std::string &path, const uint8_t *rgba, uint32_t width, uint32_t height, std::vector<uint8_t> &scanlines) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open capture file!");
+    }
+
+    auto put32 = [](std::vector<uint8_t> &out, uint32_t v) {
+        out.push_back(static_cast<uint8_t>(v >> 24));
+        out.push_back(static_cast<uint8_t>(v >> 16));
+        out.push_back(static_cast<uint8_t>(v >> 8));
+        out.push_back(static_cast<uint8_t>(v));
+    };
+
+    auto writeChunk = [&](const char *type, const std::vector<uint8_t> &data) {
+        std::vector<uint8_t> header;
+        put32(header, static_cast<uint32_t>(data.size()));
+        header.insert(header.end(), type, type + 4);
+
+        uint32_t crc = crc32(header.data() + 4, 4);
+        crc = crc32(data.data(), data.size(), crc);
+
+        std::vector<uint8_t> footer;
+        put32(footer, crc);
+
+        file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+    };
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // 8 bits per channel, color type 6 (RGBA), no interlacing
+    std::vector<uint8_t> ihdr;
+    put32(ihdr, width);
+    put32(ihdr, height);
+    ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0});
+    writeChunk("IHDR", ihdr);
+
+    // Every scanline starts with filter type 0 (none)
+    size_t rowSize = size_t(width) * 4;
+    scanlines.resize((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *row = scanlines.data() + y * (rowSize + 1);
+        row[0] = 0;
+        std::memcpy(row + 1, rgba + y * rowSize, rowSize);
+    }
+
+    // zlib stream made of stored blocks, each at most 65535 bytes
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    idat.reserve(scanlines.size() + scanlines.size() / 65535 * 5 + 16);
+    uint32_t a = 1, b = 0;
+    size_t offset = 0;
+    do {
+        size_t blockSize = std::min<size_t>(scanlines.size() - offset, 65535);
+        bool last = offset + blockSize == scanlines.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(static_cast<uint8_t>(blockSize));
+        idat.push_back(static_cast<uint8_t>(blockSize >> 8));
+        idat.push_back(static_cast<uint8_t>(~blockSize));
+        idat.push_back(static_cast<uint8_t>(~blockSize >> 8));
+        idat.insert(idat.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+
+        for (size_t i = offset; i < offset + blockSize; i++) {
+            a = (a + scanlines[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += blockSize;
+    } while (offset < scanlines.size());
+    put32(idat, (b << 16) | a);
+    writeChunk("IDAT", idat);
+
+    writeChunk("IEND", {});
+}
+
+// Copies presented frames into a ring of host-visible buffers and hands them
+// to an encoder thread that writes them to disk. The render loop never waits
+// on the GPU or the encoder for this: a buffer is only read once the timeline
+// value of the submit that filled it is known to be complete, and if every
+// buffer is still busy the frame simply isn't captured.
+class FrameCapture {
+    public:
+        static constexpr uint32_t RING_SIZE = MAX_FRAMES_IN_FLIGHT + 2;
+
+        void create(VkDevice device, VkPhysicalDevice physicalDevice, VkExtent2D extent, VkFormat format,
+                    const CaptureSettings &settings, const HostAllocator &hostAllocator) {
+            this->device = device;
+            this->extent = extent;
+            this->format = format;
+            this->settings = settings;
+            this->pBufferAllocator = hostAllocator.callbacks(AllocationTag::Buffer);
+            this->pMemoryAllocator = hostAllocator.callbacks(AllocationTag::DeviceMemory);
+
+            // Only 4 byte per pixel formats can be turned into a PNG as is
+            bool bgra = format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM;
+            bool rgba = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM;
+            if (!bgra && !rgba) {
+                throw std::runtime_error("frame capture only supports 8-bit RGBA/BGRA swap chains!");
+            }
+            swapRedBlue = bgra;
+
+            std::filesystem::create_directories(settings.directory);
+
+            VkDeviceSize frameSize = VkDeviceSize(extent.width) * extent.height * 4;
+            for (Slot &slot : slots) {
+                createReadbackBuffer(physicalDevice, frameSize, slot);
+            }
+
+            encoderThread = std::thread(&FrameCapture::encoderLoop, this);
+        }
+
+        // Only reached without destroy() when cleanup was skipped by an
+        // exception. Copies that may still be in flight are dropped and the
+        // Vulkan objects are left alone, but the encoder thread must not
+        // outlive us.
+        ~FrameCapture() {
+            stopEncoder();
+        }
+
+        // Flushes whatever is still queued to disk. The device must be idle.
+        void destroy() {
+            if (device == VK_NULL_HANDLE) return;
+
+            retire(UINT64_MAX);
+            stopEncoder();
+
+            for (Slot &slot : slots) {
+                vkUnmapMemory(device, slot.memory);
+                vkDestroyBuffer(device, slot.buffer, pBufferAllocator);
+                vkFreeMemory(device, slot.memory, pMemoryAllocator);
+            }
+
+            std::cout << "frame capture: " << framesWritten << " frames written to " << settings.directory
+                      << ", " << framesDropped << " dropped (all readback buffers busy)" << std::endl;
+
+            device = VK_NULL_HANDLE;
+        }
+
+        // Records a copy of image into a free readback buffer and leaves the
+        // image in PRESENT_SRC layout. Returns false (and records nothing) if
+        // every buffer is still in flight or being encoded. frameNumber is the
+        // rendered frame's index, so dropped frames leave a gap in the file names.
+        bool recordCopy(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout currentLayout,
+                        VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, uint64_t frameNumber) {
+            Slot *slot = nullptr;
+            for (Slot &candidate : slots) {
+                if (candidate.state.load(std::memory_order_acquire) == SlotState::Free) {
+                    slot = &candidate;
+                    break;
+                }
+            }
+
+            if (slot == nullptr) {
+                framesDropped++;
+                return false;
+            }
+
+            recordImageBarrier(commandBuffer, image, currentLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                srcStage, VK_PIPELINE_STAGE_TRANSFER_BIT, srcAccess, VK_ACCESS_TRANSFER_READ_BIT);
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = 0;
+            region.bufferRowLength = 0; // tightly packed
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {extent.width, extent.height, 1};
+
+            vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+            // Make the copy visible to the host once the frame's timeline value signals
+            VkBufferMemoryBarrier bufferBarrier{};
+            bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.buffer = slot->buffer;
+            bufferBarrier.offset = 0;
+            bufferBarrier.size = VK_WHOLE_SIZE;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+            recordImageBarrier(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_ACCESS_TRANSFER_READ_BIT, 0);
+
+            slot->timelineValue = 0;
+            slot->frameNumber = frameNumber;
+            slot->state.store(SlotState::Copying, std::memory_order_release);
+            return true;
+        }
+
+        // Tag copies recorded since the last call with the timeline value
+        // their submit will signal
+        void submitted(uint64_t timelineValue) {
+            for (Slot &slot : slots) {
+                if (slot.state.load(std::memory_order_relaxed) == SlotState::Copying && slot.timelineValue == 0) {
+                    slot.timelineValue = timelineValue;
+                }
+            }
+        }
+
+        // Everything up to completedValue is done on the GPU, so those copies
+        // are in host memory and can go to the encoder
+        void retire(uint64_t completedValue) {
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                for (uint32_t i = 0; i < RING_SIZE; i++) {
+                    Slot &slot = slots[i];
+                    if (slot.state.load(std::memory_order_relaxed) == SlotState::Copying &&
+                        slot.timelineValue != 0 && slot.timelineValue <= completedValue) {
+                        slot.state.store(SlotState::Encoding, std::memory_order_relaxed);
+                        encodeQueue.push_back(i);
+                        queued = true;
+                    }
+                }
+            }
+
+            if (queued) {
+                queueCondition.notify_one();
+            }
+        }
+
+    private:
+        enum class SlotState : uint8_t {
+            Free,    // ready to be copied into
+            Copying, // GPU copy recorded/submitted, not complete yet
+            Encoding // owned by the encoder thread
+        };
+
+        struct Slot {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            const uint8_t *mapped = nullptr;
+            std::atomic<SlotState> state{SlotState::Free};
+            uint64_t timelineValue = 0; // signalled once the copy is done, 0 until submitted
+            uint64_t frameNumber = 0; // used for the file name
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *pBufferAllocator = nullptr;
+        const VkAllocationCallbacks *pMemoryAllocator = nullptr;
+        VkExtent2D extent{};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        CaptureSettings settings;
+        bool swapRedBlue = false;
+
+        std::array<Slot, RING_SIZE> slots;
+        uint64_t framesDropped = 0;
+        std::atomic<uint64_t> framesWritten{0};
+
+        std::thread encoderThread;
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::deque<uint32_t> encodeQueue; // slot indices, oldest first
+        bool stopping = false;
+
+        // Lets the encoder drain its queue and exit
+        void stopEncoder() {
+            if (!encoderThread.joinable()) return;
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                stopping = true;
+            }
+            queueCondition.notify_one();
+            encoderThread.join();
+        }
+
+        void createReadbackBuffer(VkPhysicalDevice physicalDevice, VkDeviceSize size, Slot &slot) {
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateBuffer(device, &bufferInfo, pBufferAllocator, &slot.buffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create readback buffer!");
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetBufferMemoryRequirements(device, slot.buffer, &memRequirements);
+
+            // CPU reads from uncached memory are painfully slow, so try for cached first
+            const VkMemoryPropertyFlags coherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            uint32_t memoryType;
+            try {
+                memoryType = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, coherent | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+            }
+            catch (const std::runtime_error&) {
+                memoryType = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, coherent);
+            }
+
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = memRequirements.size;
+            allocInfo.memoryTypeIndex = memoryType;
+
+            if (vkAllocateMemory(device, &allocInfo, pMemoryAllocator, &slot.memory) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate readback buffer memory!");
+            }
+
+            vkBindBufferMemory(device, slot.buffer, slot.memory, 0);
+
+            void *data;
+            if (vkMapMemory(device, slot.memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+                throw std::runtime_error("failed to map readback buffer!");
+            }
+            slot.mapped = static_cast<const uint8_t*>(data);
+        }
+
+        // Runs on its own thread until destroy(), writing one file per slot it's handed
+        void encoderLoop() {
+            std::vector<uint8_t> pixels;
+            std::vector<uint8_t> scratch;
+
+            while (true) {
+                uint32_t index;
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    queueCondition.wait(lock, [this] { return stopping || !encodeQueue.empty(); });
+                    if (encodeQueue.empty()) return; // stopping and drained
+
+                    index = encodeQueue.front();
+                    encodeQueue.pop_front();
+                }
+
+                Slot &slot = slots[index];
+                try {
+                    writeFrame(slot, pixels, scratch);
+                    framesWritten++;
+                }
+                catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+
+                slot.state.store(SlotState::Free, std::memory_order_release);
+            }
+        }
+
+        void writeFrame(const Slot &slot, std::vector<uint8_t> &pixels, std::vector<uint8_t> &scratch) {
+            size_t frameSize = size_t(extent.width) * extent.height * 4;
+            char name[64];
+
+            if (settings.format == CaptureFormat::Raw) {
+                snprintf(name, sizeof(name), "frame_%06llu_%ux%u.raw",
+                    static_cast<unsigned long long>(slot.frameNumber), extent.width, extent.height);
+
+                std::ofstream file((std::filesystem::path(settings.directory) / name).string(), std::ios::binary);
+                if (!file.is_open()) {
+                    throw std::runtime_error("failed to open capture file!");
+                }
+                file.write(reinterpret_cast<const char*>(slot.mapped), frameSize);
+                return;
+            }
+
+            // PNG wants RGBA, and the swap chain is opaque so force alpha to 1
+            pixels.resize(frameSize);
+            for (size_t i = 0; i < frameSize; i += 4) {
+                pixels[i + 0] = slot.mapped[i + (swapRedBlue ? 2 : 0)];
+                pixels[i + 1] = slot.mapped[i + 1];
+                pixels[i + 2] = slot.mapped[i + (swapRedBlue ? 0 : 2)];
+                pixels[i + 3] = 0xff;
+            }
+
+            snprintf(name, sizeof(name), "frame_%06llu.png", static_cast<unsigned long long>(slot.frameNumber));
+            writePng((std::filesystem::path(settings.directory) / name).string(), pixels.data(), extent.width, extent.height, scratch);
+        }
+};
+
+
+// Timeline semaphore submission scheduler
+// =======================================================
+
+// How the device provides timeline semaphores, if at all
+enum class TimelineSupport {
+    None,      // fences stand in, see SubmissionScheduler
+    Extension, // VK_KHR_timeline_semaphore on a 1.1 device
+    Core       // Vulkan 1.2
+};
+
+// Each queue, and each CPU-side producer, owns a timeline semaphore. Every
+// submit signals the next value on its timeline, so "is this done yet" is an
+// integer compare against the timeline's completed value rather than a fence
+// per frame. Work declares what it depends on as (timeline, value) points,
+// which can cross queues and go between the CPU and the GPU.
+//
+// Without timeline semaphores each submit gets a pooled fence instead. A
+// timeline's completed value then comes from its fences in submission order,
+// and GPU work waits on the CPU for any dependency that isn't done yet.
+class SubmissionScheduler {
+    public:
+        struct TimelinePoint {
+            uint32_t timeline = 0;
+            uint64_t value = 0; // 0 counts as complete from the start
+        };
+
+        // GPU work waits for point before stage
+        struct Dependency {
+            TimelinePoint point;
+            VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        };
+
+        struct GpuJob {
+            const VkCommandBuffer *pCommandBuffers = nullptr;
+            uint32_t commandBufferCount = 0;
+            const Dependency *pDependencies = nullptr;
+            uint32_t dependencyCount = 0;
+
+            // The swap chain only speaks binary semaphores
+            VkSemaphore waitBinary = VK_NULL_HANDLE;
+            VkPipelineStageFlags waitBinaryStage = 0;
+            VkSemaphore signalBinary = VK_NULL_HANDLE;
+        };
+
+        static constexpr uint32_t MAX_DEPENDENCIES = 8;
+
+        void create(VkDevice device, const HostAllocator &hostAllocator, TimelineSupport support) {
+            this->device = device;
+            this->support = support;
+            this->pSemaphoreAllocator = hostAllocator.callbacks(AllocationTag::Semaphore);
+            this->pFenceAllocator = hostAllocator.callbacks(AllocationTag::Fence);
+
+            if (support == TimelineSupport::None) return;
+
+            // Same functions either way, the extension just has them under a KHR suffix
+            bool core = support == TimelineSupport::Core;
+            waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(
+                vkGetDeviceProcAddr(device, core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+            signalSemaphore = reinterpret_cast<PFN_vkSignalSemaphore>(
+                vkGetDeviceProcAddr(device, core ? "vkSignalSemaphore" : "vkSignalSemaphoreKHR"));
+            getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+                vkGetDeviceProcAddr(device, core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+
+            if (waitSemaphores == nullptr || signalSemaphore == nullptr || getSemaphoreCounterValue == nullptr) {
+                throw std::runtime_error("failed to load timeline semaphore functions!");
+            }
+        }
+
+        // The device must be idle
+        void destroy() {
+            for (Timeline &timeline : timelines) {
+                if (timeline.semaphore != VK_NULL_HANDLE) {
+                    vkDestroySemaphore(device, timeline.semaphore, pSemaphoreAllocator);
+                }
+                for (const InFlightSubmit &inFlight : timeline.inFlight) {
+                    vkDestroyFence(device, inFlight.fence, pFenceAllocator);
+                }
+            }
+            for (VkFence fence : freeFences) {
+                vkDestroyFence(device, fence, pFenceAllocator);
+            }
+            timelines.clear();
+            freeFences.clear();
+        }
+
+        // Timeline that gets a new value for each submit to queue
+        uint32_t addQueue(VkQueue queue) {
+            return addTimeline(queue);
+        }
+
+        // Timeline signalled from the CPU by scheduleHost() jobs
+        uint32_t addHostTimeline() {
+            return addTimeline(VK_NULL_HANDLE);
+        }
+
+        TimelinePoint submit(uint32_t timelineIndex, const GpuJob &job) {
+            Timeline &timeline = timelines[timelineIndex];
+            if (timeline.queue == VK_NULL_HANDLE) {
+                throw std::runtime_error("can't submit GPU work to a host timeline!");
+            }
+            if (job.dependencyCount > MAX_DEPENDENCIES) {
+                throw std::runtime_error("too many dependencies for one submit!");
+            }
+
+            VkSemaphore waitSemaphoreHandles[MAX_DEPENDENCIES + 1];
+            uint64_t waitValues[MAX_DEPENDENCIES + 1];
+            VkPipelineStageFlags waitStages[MAX_DEPENDENCIES + 1];
+            uint32_t waitCount = 0;
+
+            for (uint32_t i = 0; i < job.dependencyCount; i++) {
+                const Dependency &dependency = job.pDependencies[i];
+                if (isComplete(dependency.point)) continue; // already done, nothing to wait on
+
+                // Nothing the GPU could wait on, so hold the submit back instead. Host
+                // jobs are too: they only run from poll()/wait() on this thread, so a
+                // GPU wait for one that hasn't run yet would leave any later wait()
+                // on this submit blocked in the driver for good.
+                if (support == TimelineSupport::None || timelines[dependency.point.timeline].queue == VK_NULL_HANDLE) {
+                    wait(dependency.point);
+                    continue;
+                }
+
+                waitSemaphoreHandles[waitCount] = timelines[dependency.point.timeline].semaphore;
+                waitValues[waitCount] = dependency.point.value;
+                waitStages[waitCount] = dependency.stage;
+                waitCount++;
+            }
+
+            if (job.waitBinary != VK_NULL_HANDLE) {
+                waitSemaphoreHandles[waitCount] = job.waitBinary;
+                waitValues[waitCount] = 0; // ignored for binary semaphores
+                waitStages[waitCount] = job.waitBinaryStage;
+                waitCount++;
+            }
+
+            uint64_t signalValue = timeline.submitted + 1;
+            VkSemaphore signalSemaphores[2];
+            uint64_t signalValues[2];
+            uint32_t signalCount = 0;
+            if (timeline.semaphore != VK_NULL_HANDLE) {
+                signalSemaphores[signalCount] = timeline.semaphore;
+                signalValues[signalCount++] = signalValue;
+            }
+            if (job.signalBinary != VK_NULL_HANDLE) {
+                signalSemaphores[signalCount] = job.signalBinary;
+                signalValues[signalCount++] = 0;
+            }
+
+            VkTimelineSemaphoreSubmitInfo timelineInfo{};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfo.waitSemaphoreValueCount = waitCount;
+            timelineInfo.pWaitSemaphoreValues = waitValues;
+            timelineInfo.signalSemaphoreValueCount = signalCount;
+            timelineInfo.pSignalSemaphoreValues = signalValues;
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.pNext = support != TimelineSupport::None ? &timelineInfo : nullptr;
+            submitInfo.waitSemaphoreCount = waitCount;
+            submitInfo.pWaitSemaphores = waitSemaphoreHandles;
+            submitInfo.pWaitDstStageMask = waitStages;
+            submitInfo.commandBufferCount = job.commandBufferCount;
+            submitInfo.pCommandBuffers = job.pCommandBuffers;
+            submitInfo.signalSemaphoreCount = signalCount;
+            submitInfo.pSignalSemaphores = signalSemaphores;
+
+            VkFence fence = support == TimelineSupport::None ? acquireFence() : VK_NULL_HANDLE;
+
+            if (vkQueueSubmit(timeline.queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+                if (fence != VK_NULL_HANDLE) freeFences.push_back(fence);
+                throw std::runtime_error("failed to submit command buffer!");
+            }
+
+            if (fence != VK_NULL_HANDLE) {
+                timeline.inFlight.push_back({signalValue, fence});
+            }
+            timeline.submitted = signalValue;
+            return {timelineIndex, signalValue};
+        }
+
+        // CPU job that runs from poll() once everything in waits is done, then
+        // signals its own point so GPU work (or other CPU jobs) can depend on it.
+        // Jobs on the same host timeline run in the order they were scheduled.
+        // Waits have to be points that were already handed out, so nothing can
+        // end up waiting on itself.
+        TimelinePoint scheduleHost(uint32_t timelineIndex, std::initializer_list<TimelinePoint> waits, std::function<void()> job) {
+            Timeline &timeline = timelines[timelineIndex];
+            if (timeline.queue != VK_NULL_HANDLE) {
+                throw std::runtime_error("can't schedule CPU work on a queue timeline!");
+            }
+            for (const TimelinePoint &point : waits) {
+                if (point.value > timelines[point.timeline].submitted) {
+                    throw std::runtime_error("host job waits on a point that hasn't been submitted!");
+                }
+            }
+
+            HostJob hostJob;
+            hostJob.waits.assign(waits.begin(), waits.end());
+            hostJob.value = ++timeline.submitted;
+            hostJob.run = std::move(job);
+            timeline.hostJobs.push_back(std::move(hostJob));
+
+            return {timelineIndex, timeline.submitted};
+        }
+
+        // As of the last poll()/wait(), doesn't go to the driver
+        bool isComplete(TimelinePoint point) const {
+            return point.value <= timelines[point.timeline].completed;
+        }
+
+        uint64_t completedValue(uint32_t timelineIndex) const {
+            return timelines[timelineIndex].completed;
+        }
+
+        // Block the CPU until point is done
+        void wait(TimelinePoint point) {
+            if (isComplete(point)) return;
+
+            Timeline &timeline = timelines[point.timeline];
+            if (point.value > timeline.submitted) {
+                throw std::runtime_error("waiting on a point that hasn't been submitted!");
+            }
+
+            // Host timelines only move forward from poll(). If that leaves point
+            // pending, the oldest job on its timeline is blocked on an earlier
+            // point, so wait for that and go again. Waits always point back in
+            // submission order, so this bottoms out at GPU work.
+            if (timeline.queue == VK_NULL_HANDLE) {
+                poll();
+                while (!isComplete(point)) {
+                    for (const TimelinePoint &blocker : timeline.hostJobs.front().waits) {
+                        if (!isComplete(blocker)) {
+                            wait(blocker);
+                            break;
+                        }
+                    }
+                    poll();
+                }
+                return;
+            }
+
+            if (support == TimelineSupport::None) {
+                // Every submit up to and including point.value
+                waitFences.clear();
+                for (const InFlightSubmit &inFlight : timeline.inFlight) {
+                    if (inFlight.value > point.value) break;
+                    waitFences.push_back(inFlight.fence);
+                }
+
+                if (!waitFences.empty() &&
+                    vkWaitForFences(device, static_cast<uint32_t>(waitFences.size()), waitFences.data(), VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to wait for submit fences!");
+                }
+            }
+            else {
+                VkSemaphoreWaitInfo waitInfo{};
+                waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+                waitInfo.semaphoreCount = 1;
+                waitInfo.pSemaphores = &timeline.semaphore;
+                waitInfo.pValues = &point.value;
+
+                if (waitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to wait for timeline semaphore!");
+                }
+            }
+
+            refresh(timeline);
+        }
+
+        // Pick up what the GPU has finished, then run whatever that unblocked
+        void poll() {
+            for (Timeline &timeline : timelines) {
+                if (timeline.queue != VK_NULL_HANDLE) {
+                    refresh(timeline);
+                }
+            }
+
+            // A host job finishing can unblock jobs on other host timelines
+            bool progressed = true;
+            while (progressed) {
+                progressed = false;
+                for (Timeline &timeline : timelines) {
+                    while (!timeline.hostJobs.empty() && allComplete(timeline.hostJobs.front().waits)) {
+                        HostJob job = std::move(timeline.hostJobs.front());
+                        timeline.hostJobs.pop_front();
+
+                        job.run();
+
+                        if (timeline.semaphore != VK_NULL_HANDLE) {
+                            VkSemaphoreSignalInfo signalInfo{};
+                            signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+                            signalInfo.semaphore = timeline.semaphore;
+                            signalInfo.value = job.value;
+
+                            if (signalSemaphore(device, &signalInfo) != VK_SUCCESS) {
+                                throw std::runtime_error("failed to signal timeline semaphore!");
+                            }
+                        }
+
+                        timeline.completed = job.value;
+                        progressed = true;
+                    }
+                }
+            }
+        }
+
+    private:
+        struct HostJob {
+            std::vector<TimelinePoint> waits;
+            uint64_t value = 0;
+            std::function<void()> run;
+        };
+
+        // Fence path only, one per submit not known to be done yet
+        struct InFlightSubmit {
+            uint64_t value;
+            VkFence fence;
+        };
+
+        struct Timeline {
+            VkQueue queue = VK_NULL_HANDLE; // null for host timelines
+            VkSemaphore semaphore = VK_NULL_HANDLE; // null without timeline semaphore support
+            uint64_t submitted = 0; // last value handed out
+            uint64_t completed = 0; // last value known to be signalled
+            std::deque<HostJob> hostJobs;
+            std::deque<InFlightSubmit> inFlight; // oldest first
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        TimelineSupport support = TimelineSupport::None;
+        const VkAllocationCallbacks *pSemaphoreAllocator = nullptr;
+        const VkAllocationCallbacks *pFenceAllocator = nullptr;
+        PFN_vkWaitSemaphores waitSemaphores = nullptr;
+        PFN_vkSignalSemaphore signalSemaphore = nullptr;
+        PFN_vkGetSemaphoreCounterValue getSemaphoreCounterValue = nullptr;
+        std::vector<Timeline> timelines;
+        std::vector<VkFence> freeFences; // reset and ready for the next submit
+        std::vector<VkFence> waitFences; // scratch for wait()
+
+        uint32_t addTimeline(VkQueue queue) {
+            Timeline timeline;
+            timeline.queue = queue;
+
+            if (support == TimelineSupport::None) {
+                timelines.push_back(std::move(timeline));
+                return static_cast<uint32_t>(timelines.size() - 1);
+            }
+
+            VkSemaphoreTypeCreateInfo typeInfo{};
+            typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            typeInfo.initialValue = 0;
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext = &typeInfo;
+
+            if (vkCreateSemaphore(device, &semaphoreInfo, pSemaphoreAllocator, &timeline.semaphore) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timeline semaphore!");
+            }
+
+            timelines.push_back(std::move(timeline));
+            return static_cast<uint32_t>(timelines.size() - 1);
+        }
+
+        void refresh(Timeline &timeline) {
+            if (support != TimelineSupport::None) {
+                getSemaphoreCounterValue(device, timeline.semaphore, &timeline.completed);
+                return;
+            }
+
+            // Submits on one queue complete in order, stop at the first one still running
+            while (!timeline.inFlight.empty()) {
+                InFlightSubmit &oldest = timeline.inFlight.front();
+                if (vkGetFenceStatus(device, oldest.fence) != VK_SUCCESS) break;
+
+                timeline.completed = oldest.value;
+                vkResetFences(device, 1, &oldest.fence);
+                freeFences.push_back(oldest.fence);
+                timeline.inFlight.pop_front();
+            }
+        }
+
+        VkFence acquireFence() {
+            if (!freeFences.empty()) {
+                VkFence fence = freeFences.back();
+                freeFences.pop_back();
+                return fence;
+            }
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+            VkFence fence;
+            if (vkCreateFence(device, &fenceInfo, pFenceAllocator, &fence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create submit fence!");
+            }
+            return fence;
+        }
+
+        bool allComplete(const std::vector<TimelinePoint> &points) const {
+            for (const TimelinePoint &point : points) {
+                if (!isComplete(point)) return false;
+            }
+            return true;
+        }
+};
+
+
+// Dynamic resolution
+// =======================================================
+
+struct ResolutionSettings {
+    float targetFrameMs = 1000.0f / 60.0f; // GPU time for the scene we try to stay under
+    float minScale = 0.5f; // never go below this fraction of the swap chain size (per axis)
+    float maxScale = 1.0f;
+    float deadband = 0.05f; // don't touch the scale while within this fraction of the target
+    float maxStepDown = 0.10f; // biggest per-frame drop in scale
+    float maxStepUp = 0.02f; // biggest per-frame rise, slower so we don't bounce straight back over budget
+};
+
+struct ResolutionSample {
+    float gpuMs; // measured scene time
+    float scale; // scale that frame was rendered at
+};
+
+// Throws unless the controller can work with settings (NaNs included)
+void validateResolutionSettings(const ResolutionSettings &settings) {
+    if (!(settings.targetFrameMs > 0.0f)) {
+        throw std::runtime_error("dynamic resolution target frame time must be positive!");
+    }
+    if (!(settings.minScale > 0.0f && settings.minScale <= settings.maxScale && settings.maxScale <= 1.0f)) {
+        throw std::runtime_error("dynamic resolution scale limits must satisfy 0 < min <= max <= 1!");
+    }
+    if (!(settings.deadband >= 0.0f)) {
+        throw std::runtime_error("dynamic resolution deadband can't be negative!");
+    }
+    if (!(settings.maxStepDown > 0.0f && settings.maxStepUp > 0.0f)) {
+        throw std::runtime_error("dynamic resolution scale steps must be positive!");
+    }
+}
+
+// Optional float setting, fallback when the variable isn't set
+float floatFromEnvironment(const char *name, float fallback) {
+    const char *value = std::getenv(name);
+    if (value == nullptr) return fallback;
+
+    char *end = nullptr;
+    float parsed = std::strtof(value, &end);
+    if (end == value || *end != '\0') {
+        throw std::runtime_error(std::string(name) + " must be a number!");
+    }
+    return parsed;
+}
+
+// BUDDY_DYNAMIC_RESOLUTION=<target GPU ms> turns dynamic resolution on.
+// BUDDY_DYNAMIC_RESOLUTION_MIN_SCALE, _MAX_SCALE, _DEADBAND, _STEP_DOWN and
+// _STEP_UP override the rest of ResolutionSettings.
+std::optional<ResolutionSettings> resolutionSettingsFromEnvironment() {
+    if (std::getenv("BUDDY_DYNAMIC_RESOLUTION") == nullptr) return std::nullopt;
+
+    ResolutionSettings settings;
+    settings.targetFrameMs = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION", settings.targetFrameMs);
+    settings.minScale = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION_MIN_SCALE", settings.minScale);
+    settings.maxScale = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION_MAX_SCALE", settings.maxScale);
+    settings.deadband = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION_DEADBAND", settings.deadband);
+    settings.maxStepDown = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION_STEP_DOWN", settings.maxStepDown);
+    settings.maxStepUp = floatFromEnvironment("BUDDY_DYNAMIC_RESOLUTION_STEP_UP", settings.maxStepUp);
+
+    validateResolutionSettings(settings);
+    return settings;
+}
+
+// BUDDY_DYNAMIC_RESOLUTION_HISTORY=<file> dumps the controller's history there at exit
+std::string resolutionHistoryFileFromEnvironment() {
+    const char *file = std::getenv("BUDDY_DYNAMIC_RESOLUTION_HISTORY");
+    return file != nullptr ? file : "";
+}
+
+// Feedback controller picking the render scale from measured GPU frame times.
+// GPU cost is roughly proportional to pixel count, so each sample is turned
+// into "cost at full resolution" (ms / scale^2), smoothed, and the scale that
+// would land on the target is sqrt(target / cost). Drops are allowed to be
+// big and rises small, so heavy frames shed resolution quickly and it comes
+// back gradually.
+class ResolutionController {
+    public:
+        static constexpr size_t HISTORY_SIZE = 240;
+
+        const ResolutionSettings &getSettings() const {
+            return settings;
+        }
+
+        // Throws on settings the controller can't work with, see validateResolutionSettings()
+        void setSettings(const ResolutionSettings &newSettings) {
+            validateResolutionSettings(newSettings);
+            settings = newSettings;
+            currentScale = std::clamp(currentScale, settings.minScale, settings.maxScale);
+        }
+
+        void setTarget(float frameMs) {
+            ResolutionSettings newSettings = settings;
+            newSettings.targetFrameMs = frameMs;
+            setSettings(newSettings);
+        }
+
+        // Feed in the GPU time of a finished frame and the scale it was
+        // rendered at, get back the scale to render the next frame at
+        float update(float gpuMs, float renderedScale) {
+            if (!(gpuMs > 0.0f) || !(renderedScale > 0.0f)) return currentScale;
+
+            history[historyNext] = {gpuMs, renderedScale};
+            historyNext = (historyNext + 1) % HISTORY_SIZE;
+            historyCount = std::min(historyCount + 1, HISTORY_SIZE);
+
+            // Smooth out single frame spikes
+            float fullResolutionMs = gpuMs / (renderedScale * renderedScale);
+            if (historyCount == 1) {
+                smoothedFullResolutionMs = fullResolutionMs;
+            }
+            else {
+                smoothedFullResolutionMs += SMOOTHING * (fullResolutionMs - smoothedFullResolutionMs);
+            }
+
+            float predictedMs = smoothedFullResolutionMs * currentScale * currentScale;
+            if (std::abs(predictedMs / settings.targetFrameMs - 1.0f) <= settings.deadband) {
+                return currentScale;
+            }
+
+            float wantedScale = std::sqrt(settings.targetFrameMs / smoothedFullResolutionMs);
+            float step = std::clamp(wantedScale - currentScale, -settings.maxStepDown, settings.maxStepUp);
+            currentScale = std::clamp(currentScale + step, settings.minScale, settings.maxScale);
+
+            return currentScale;
+        }
+
+        float scale() const {
+            return currentScale;
+        }
+
+        // What the current scale is expected to cost, from the smoothed samples
+        float predictedFrameMs() const {
+            return smoothedFullResolutionMs * currentScale * currentScale;
+        }
+
+        // Last HISTORY_SIZE samples, oldest first
+        std::vector<ResolutionSample> getHistory() const {
+            std::vector<ResolutionSample> ordered;
+            ordered.reserve(historyCount);
+
+            size_t first = (historyNext + HISTORY_SIZE - historyCount) % HISTORY_SIZE;
+            for (size_t i = 0; i < historyCount; i++) {
+                ordered.push_back(history[(first + i) % HISTORY_SIZE]);
+            }
+            return ordered;
+        }
+
+        // getHistory() as CSV, oldest sample first
+        void writeHistory(std::ostream &out) const {
+            out << "sample,gpu_ms,scale" << std::endl;
+            std::vector<ResolutionSample> samples = getHistory();
+            for (size_t i = 0; i < samples.size(); i++) {
+                out << i << "," << samples[i].gpuMs << "," << samples[i].scale << std::endl;
+            }
+        }
+
+        void printStats(std::ostream &out) const {
+            float totalMs = 0.0f, totalScale = 0.0f, lowestScale = settings.maxScale;
+            for (const ResolutionSample &sample : getHistory()) {
+                totalMs += sample.gpuMs;
+                totalScale += sample.scale;
+                lowestScale = std::min(lowestScale, sample.scale);
+            }
+
+            out << "dynamic resolution: target " << settings.targetFrameMs << " ms, scale "
+                << currentScale << " (limits " << settings.minScale << " - " << settings.maxScale << ")";
+            if (historyCount > 0) {
+                out << ", last " << historyCount << " frames averaged " << totalMs / historyCount
+                    << " ms at scale " << totalScale / historyCount << " (lowest " << lowestScale << ")";
+            }
+            out << std::endl;
+        }
+
+    private:
+        static constexpr float SMOOTHING = 0.2f;
+
+        ResolutionSettings settings;
+        float currentScale = 1.0f;
+        float smoothedFullResolutionMs = 0.0f;
+
+        std::array<ResolutionSample, HISTORY_SIZE> history{};
+        size_t historyNext = 0;
+        size_t historyCount = 0;
+};
+
+
+// Draw queue
+// =======================================================
+
+// One draw as handed to the queue. Pipelines, materials and meshes are the
+// ids returned by DrawQueue::addPipeline/addMaterial/addMesh.
+struct DrawPacket {
+    uint32_t pass = 0; // e.g. opaque before transparent, lower passes are recorded first
+    uint32_t pipeline = 0;
+    uint32_t material = 0; // 0 is DrawQueue::NO_MATERIAL
+    uint32_t mesh = 0;
+    uint32_t dynamicOffset = 0; // for the material's dynamic uniform buffer, if it has one
+    float depth = 0.0f; // view depth in [0, 1], NaN/inf are rejected by DrawQueue::submit()
+    bool backToFront = false; // sort far to near (blended passes) instead of near to far
+    uint32_t instanceId = 0; // caller's index for per-instance data, see DrawQueue::instances()
+};
+
+struct DrawQueueStats {
+    uint64_t draws = 0; // packets submitted
+    uint64_t batches = 0; // vkCmdDraw calls actually recorded
+    uint64_t pipelineBinds = 0;
+    uint64_t materialBinds = 0;
+    uint64_t unsortedPipelineBinds = 0; // what recording in submission order would have cost
+    uint64_t unsortedMaterialBinds = 0;
+};
+
+// Collects draws for a frame, sorts them by a 64-bit key so that draws sharing
+// state end up next to each other, and records them with a bind only when the
+// state actually changes. Consecutive draws of the same mesh with the same
+// pipeline, material and dynamic offset are merged into one instanced draw, as
+// long as the pipeline picks its per-draw data by gl_InstanceIndex.
+//
+// Key layouts, most significant first:
+//   front to back: pass 4 | 0 | pipeline 10 | material 14 | mesh 12 | depth 23
+//   back to front: pass 4 | 1 | depth 23 | pipeline 10 | material 14 | mesh 12
+// Front to back, mesh sits above depth so draws of one mesh stay together and
+// can be instanced; depth then orders the instances within a batch. Back to
+// front the order is what makes blending right, so depth comes first and those
+// draws are never merged. Within a pass they're recorded after the front to
+// back draws.
+class DrawQueue {
+    public:
+        static constexpr uint32_t PASS_BITS = 4;
+        static constexpr uint32_t ORDER_BITS = 1;
+        static constexpr uint32_t PIPELINE_BITS = 10;
+        static constexpr uint32_t MATERIAL_BITS = 14;
+        static constexpr uint32_t MESH_BITS = 12;
+        static constexpr uint32_t DEPTH_BITS = 23;
+        static constexpr uint32_t NO_MATERIAL = 0; // no descriptor set to bind
+
+        // readsInstanceData: the shaders look up per-draw data through
+        // gl_InstanceIndex and instances(), so draws can be merged into instances
+        uint32_t addPipeline(VkPipeline pipeline, VkPipelineLayout layout, bool readsInstanceData = false) {
+            if (pipelines.size() >= (1u << PIPELINE_BITS)) {
+                throw std::runtime_error("too many pipelines for the draw queue sort key!");
+            }
+            pipelines.push_back({pipeline, layout, readsInstanceData});
+            return static_cast<uint32_t>(pipelines.size() - 1);
+        }
+
+        // Descriptor set bound at setIndex whenever a draw with this material is
+        // recorded. A dynamic set has one dynamic uniform buffer, bound at each
+        // draw's DrawPacket::dynamicOffset.
+        uint32_t addMaterial(VkDescriptorSet set, uint32_t setIndex = 0, bool dynamic = false) {
+            if (materials.size() >= (1u << MATERIAL_BITS)) {
+                throw std::runtime_error("too many materials for the draw queue sort key!");
+            }
+            materials.push_back({set, setIndex, dynamic});
+            return static_cast<uint32_t>(materials.size() - 1);
+        }
+
+        uint32_t addMesh(uint32_t vertexCount, uint32_t firstVertex) {
+            if (meshes.size() >= (1u << MESH_BITS)) {
+                throw std::runtime_error("too many meshes for the draw queue sort key!");
+            }
+            meshes.push_back({vertexCount, firstVertex});
+            return static_cast<uint32_t>(meshes.size() - 1);
+        }
+
+        // Start a new frame, registered pipelines/materials/meshes are kept
+        void clear() {
+            draws.clear();
+            entries.clear();
+            batches.clear();
+            instanceOrder.clear();
+        }
+
+        void submit(const DrawPacket &packet) {
+            if (packet.pass >= (1u << PASS_BITS) || packet.pipeline >= pipelines.size()
+                || packet.material >= materials.size() || packet.mesh >= meshes.size()) {
+                throw std::runtime_error("draw submitted with an unknown pass, pipeline, material or mesh!");
+            }
+            // Casting NaN to an integer is undefined, and clamp lets it through
+            if (!std::isfinite(packet.depth)) {
+                throw std::runtime_error("draw submitted with a non-finite depth!");
+            }
+
+            uint32_t depth = static_cast<uint32_t>(std::clamp(packet.depth, 0.0f, 1.0f) * DEPTH_MAX);
+
+            uint64_t state = static_cast<uint64_t>(packet.pipeline);
+            state = (state << MATERIAL_BITS) | packet.material;
+            state = (state << MESH_BITS) | packet.mesh;
+
+            uint64_t key = (static_cast<uint64_t>(packet.pass) << ORDER_BITS) | (packet.backToFront ? 1 : 0);
+            if (packet.backToFront) {
+                key = (key << DEPTH_BITS) | (DEPTH_MAX - depth);
+                key = (key << STATE_BITS) | state;
+            } else {
+                key = (key << STATE_BITS) | state;
+                key = (key << DEPTH_BITS) | depth;
+            }
+
+            entries.push_back({key, static_cast<uint32_t>(draws.size())});
+            draws.push_back(packet);
+        }
+
+        // Sort the frame's draws and build the batches. Must be called after
+        // the last submit() and before record()/instances(). Calling it again
+        // rebuilds the batches from scratch.
+        void sort() {
+            batches.clear();
+            instanceOrder.clear();
+            radixSort();
+
+            // Front to back, everything above the depth bits and the dynamic
+            // offset have to match to share a draw call
+            for (const SortEntry &entry : entries) {
+                const DrawPacket &draw = draws[entry.draw];
+                bool mergeable = pipelines[draw.pipeline].readsInstanceData && !draw.backToFront;
+                uint64_t state = entry.key >> DEPTH_BITS;
+                if (!mergeable || batches.empty() || !batches.back().mergeable
+                    || batches.back().state != state || batches.back().dynamicOffset != draw.dynamicOffset) {
+                    batches.push_back({state, mergeable, draw.pipeline, draw.material, draw.mesh, draw.dynamicOffset,
+                                       static_cast<uint32_t>(instanceOrder.size()), 0});
+                }
+                batches.back().instanceCount++;
+                instanceOrder.push_back(draw.instanceId);
+            }
+        }
+
+        // Record the sorted batches. Viewport/scissor and the render pass are up to the caller.
+        void record(VkCommandBuffer commandBuffer) {
+            frameStats = {};
+            uint32_t boundPipeline = UNBOUND, boundMaterial = UNBOUND, boundOffset = 0;
+            VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+
+            for (const Batch &batch : batches) {
+                const PipelineEntry &pipeline = pipelines[batch.pipeline];
+                if (batch.pipeline != boundPipeline) {
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+                    boundPipeline = batch.pipeline;
+                    frameStats.pipelineBinds++;
+
+                    // Sets bound against another layout can't be relied on any more
+                    if (pipeline.layout != boundLayout) {
+                        boundLayout = pipeline.layout;
+                        boundMaterial = UNBOUND;
+                    }
+                }
 
-    return VK_FALSE;
-}
+                const MaterialEntry &material = materials[batch.material];
+                if (batch.material != boundMaterial || (material.dynamic && batch.dynamicOffset != boundOffset)) {
+                    if (material.set != VK_NULL_HANDLE) {
+                        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout,
+                                                material.setIndex, 1, &material.set,
+                                                material.dynamic ? 1 : 0, material.dynamic ? &batch.dynamicOffset : nullptr);
+                        frameStats.materialBinds++;
+                    }
+                    boundMaterial = batch.material;
+                    boundOffset = batch.dynamicOffset;
+                }
 
-// Initialize debug messenger to be used for createInstance and destroyInstance
-// since the normal debug messenger works only on a valid instance.
-void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
-    createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-    createInfo.messageSeverity = 
-        VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-        VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | 
-        VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+                const MeshEntry &mesh = meshes[batch.mesh];
+                vkCmdDraw(commandBuffer, mesh.vertexCount, batch.instanceCount, mesh.firstVertex, batch.firstInstance);
+            }
 
-    createInfo.messageType = 
-        VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-        VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-        VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-    createInfo.pfnUserCallback = debugCallback;
-}
+            frameStats.draws = draws.size();
+            frameStats.batches = batches.size();
+            countUnsortedBinds();
+            accumulate();
+        }
 
-// Load the destructor extension for the debugutils messenger and destroy that shit
-void DestroyDebugUtilsMessengerEXT(
-    VkInstance instance,
-    VkDebugUtilsMessengerEXT debugMessenger,
-    const VkAllocationCallbacks *pAllocator) {
+        // instanceId of every recorded instance, in draw order: instance i of the
+        // frame (gl_InstanceIndex == i) belongs to instances()[i]. Upload it
+        // wherever the shaders of pipelines added with readsInstanceData look
+        // up per-instance data.
+        const std::vector<uint32_t> &instances() const {
+            return instanceOrder;
+        }
 
-    auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) 
-        vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+        const DrawQueueStats &lastFrameStats() const {
+            return frameStats;
+        }
 
-    if (func != nullptr) {
-        func(instance, debugMessenger, pAllocator);
-    }
-}
+        const DrawQueueStats &totalStats() const {
+            return totals;
+        }
 
+        void printStats(std::ostream &out) const {
+            out << "draw queue: " << frames << " frames, " << totals.draws << " draws in " << totals.batches
+                << " draw calls (" << totals.draws - totals.batches << " merged into instances)" << std::endl;
+            out << "  pipeline binds " << totals.pipelineBinds << " (" << avoided(totals.unsortedPipelineBinds, totals.pipelineBinds)
+                << " avoided), descriptor set binds " << totals.materialBinds << " ("
+                << avoided(totals.unsortedMaterialBinds, totals.materialBinds) << " avoided)" << std::endl;
+        }
 
-// Class/struct definitions
-// =======================================================
-struct QueueFamilyIndices {
-    std::optional<uint32_t> graphicsFamily; // supported graphics device queue families
-    std::optional<uint32_t> presentFamily; // supported presentation queue families
-    
+    private:
+        static constexpr uint32_t STATE_BITS = PIPELINE_BITS + MATERIAL_BITS + MESH_BITS;
+        static constexpr uint32_t DEPTH_MAX = (1u << DEPTH_BITS) - 1;
+        static constexpr uint32_t UNBOUND = ~0u;
+        static_assert(PASS_BITS + ORDER_BITS + STATE_BITS + DEPTH_BITS == 64, "draw queue sort key has to fill 64 bits");
+
+        struct PipelineEntry {
+            VkPipeline pipeline;
+            VkPipelineLayout layout;
+            bool readsInstanceData;
+        };
+
+        struct MaterialEntry {
+            VkDescriptorSet set;
+            uint32_t setIndex;
+            bool dynamic;
+        };
+
+        struct MeshEntry {
+            uint32_t vertexCount;
+            uint32_t firstVertex;
+        };
+
+        struct SortEntry {
+            uint64_t key;
+            uint32_t draw; // index into draws
+        };
+
+        struct Batch {
+            uint64_t state; // key without the depth bits
+            bool mergeable; // more draws can be added as instances
+            uint32_t pipeline;
+            uint32_t material;
+            uint32_t mesh;
+            uint32_t dynamicOffset;
+            uint32_t firstInstance;
+            uint32_t instanceCount;
+        };
+
+        std::vector<PipelineEntry> pipelines;
+        std::vector<MaterialEntry> materials{{VK_NULL_HANDLE, 0, false}}; // NO_MATERIAL
+        std::vector<MeshEntry> meshes;
+
+        // Per frame, cleared but never shrunk so a steady scene doesn't allocate
+        std::vector<DrawPacket> draws;
+        std::vector<SortEntry> entries;
+        std::vector<SortEntry> scratch;
+        std::vector<Batch> batches;
+        std::vector<uint32_t> instanceOrder;
+
+        DrawQueueStats frameStats;
+        DrawQueueStats totals;
+        uint64_t frames = 0;
+
+        static uint64_t avoided(uint64_t unsorted, uint64_t sorted) {
+            return unsorted > sorted ? unsorted - sorted : 0;
+        }
 
-    bool isComplete() {
-        return graphicsFamily.has_value() && presentFamily.has_value();
-    }
-};
+        // LSD radix sort, 8 bits per pass. Stable, so equal keys keep their
+        // submission order. A pass is skipped when every key has the same digit
+        // there, which with few pipelines/materials is most of the high bytes.
+        void radixSort() {
+            size_t count = entries.size();
+            if (count < 2) return;
+            scratch.resize(count);
+
+            for (uint32_t shift = 0; shift < 64; shift += 8) {
+                std::array<size_t, 256> offsets{};
+                for (const SortEntry &entry : entries) {
+                    offsets[(entry.key >> shift) & 0xFF]++;
+                }
+                if (offsets[(entries[0].key >> shift) & 0xFF] == count) continue;
 
-struct SwapChainSupportDetails {
-    VkSurfaceCapabilitiesKHR capabilities;
-    std::vector<VkSurfaceFormatKHR> formats;
-    std::vector<VkPresentModeKHR> presentModes;
+                size_t sum = 0;
+                for (size_t &offset : offsets) {
+                    size_t digitCount = offset;
+                    offset = sum;
+                    sum += digitCount;
+                }
+                for (const SortEntry &entry : entries) {
+                    scratch[offsets[(entry.key >> shift) & 0xFF]++] = entry;
+                }
+                entries.swap(scratch);
+            }
+        }
+
+        // Binds the same draws would have needed recorded in the order they were submitted
+        void countUnsortedBinds() {
+            frameStats.unsortedPipelineBinds = 0;
+            frameStats.unsortedMaterialBinds = 0;
+
+            uint32_t boundPipeline = UNBOUND, boundMaterial = UNBOUND, boundOffset = 0;
+            VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+            for (const DrawPacket &draw : draws) {
+                if (draw.pipeline != boundPipeline) {
+                    boundPipeline = draw.pipeline;
+                    frameStats.unsortedPipelineBinds++;
+                    if (pipelines[draw.pipeline].layout != boundLayout) {
+                        boundLayout = pipelines[draw.pipeline].layout;
+                        boundMaterial = UNBOUND;
+                    }
+                }
+                const MaterialEntry &material = materials[draw.material];
+                if (draw.material != boundMaterial || (material.dynamic && draw.dynamicOffset != boundOffset)) {
+                    if (material.set != VK_NULL_HANDLE) frameStats.unsortedMaterialBinds++;
+                    boundMaterial = draw.material;
+                    boundOffset = draw.dynamicOffset;
+                }
+            }
+        }
+
+        void accumulate() {
+            totals.draws += frameStats.draws;
+            totals.batches += frameStats.batches;
+            totals.pipelineBinds += frameStats.pipelineBinds;
+            totals.materialBinds += frameStats.materialBinds;
+            totals.unsortedPipelineBinds += frameStats.unsortedPipelineBinds;
+            totals.unsortedMaterialBinds += frameStats.unsortedMaterialBinds;
+            frames++;
+        }
 };
 
 
@@ -178,6 +2203,8 @@ class HelloTriangleApplication {
         }
 
     private:
+        HostAllocator hostAllocator; // pAllocator for every create/destroy call
+        HostAllocationCounts mainLoopStartCounts; // hostAllocator.counts() once setup is done
         GLFWwindow *window; // acutal window
         VkInstance instance; // actual instance
         VkSurfaceKHR surface;
@@ -185,6 +2212,8 @@ class HelloTriangleApplication {
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE; // Physical device (GPU)
         VkPhysicalDeviceProperties physicalDeviceProperties{};
         VkDevice device = VK_NULL_HANDLE; // Logical device
+        uint32_t apiVersion = VK_API_VERSION_1_0; // Version the instance was created with
+        TimelineSupport timelineSupport = TimelineSupport::None; // What the scheduler runs on
         VkQueue graphicsQueue; // Queue for graphics device drawing
         VkQueue presentQueue; // Queue for actual surface presentation
         VkSwapchainKHR swapChain; // Swap chain
@@ -192,6 +2221,43 @@ class HelloTriangleApplication {
         VkFormat swapChainImageFormat; // img format for swap chain
         VkExtent2D swapChainExtent; // extent for swap chain
         std::vector<VkImageView> swapChainImageViews; // For accessing swap chain images
+        VkCommandPool commandPool; // Owns the command buffers below
+        std::vector<VkCommandBuffer> commandBuffers; // One per frame in flight
+        std::vector<VkSemaphore> imageAvailableSemaphores; // Swap chain image ready to be rendered to
+        std::vector<VkSemaphore> renderFinishedSemaphores; // Rendering done, ok to present (one per swap chain image)
+        SubmissionScheduler scheduler; // Timeline semaphores for every submit
+        uint32_t graphicsTimeline; // Scheduler timeline for graphicsQueue
+        uint32_t captureTimeline; // Host timeline handing captured frames to the encoder
+        std::vector<SubmissionScheduler::TimelinePoint> frameSubmits; // Last submit of each frame in flight
+        uint32_t currentFrame = 0;
+        uint64_t frameNumber = 0; // Frames rendered so far
+        FrameLinearAllocator uniformAllocator; // Per-draw uniform data, reset each frame
+        VkDescriptorSetLayout uniformSetLayout; // Set 0: the dynamic uniform buffer
+        VkDescriptorPool descriptorPool;
+        VkDescriptorSet uniformSet; // Points at uniformAllocator's buffer, offset picked per draw
+        CaptureSettings captureSettings; // Whether (and how) to dump frames to disk
+        FrameCapture frameCapture; // Readback ring + encoder thread when capturing
+        VkRenderPass renderPass; // Scene pass, into the swap chain or the offscreen target
+        VkPipelineLayout pipelineLayout;
+        VkPipeline graphicsPipeline; // Triangle pipeline, compatible with renderPass
+        DrawQueue drawQueue; // Scene draws, sorted and batched each frame
+        uint32_t trianglePipeline; // drawQueue ids for the triangle
+        uint32_t triangleMaterial;
+        uint32_t triangleMesh;
+        std::vector<VkFramebuffer> swapChainFramebuffers; // Scene target without dynamic resolution
+        std::vector<VkImage> offscreenImages; // With dynamic resolution, one per frame in flight,
+        std::vector<VkDeviceMemory> offscreenImageMemories; // scaled into the swap chain after the scene
+        std::vector<VkImageView> offscreenImageViews;
+        std::vector<VkFramebuffer> offscreenFramebuffers;
+        VkExtent2D renderExtent; // Part of the target actually rendered to
+        std::optional<ResolutionSettings> resolutionSettings; // BUDDY_DYNAMIC_RESOLUTION*, the swap chain usage depends on it
+        std::string resolutionHistoryFile; // Where to dump the controller's history at exit, if anywhere
+        bool dynamicResolution = false; // Whether renderExtent follows the controller
+        ResolutionController resolutionController;
+        VkQueryPool timestampQueryPool = VK_NULL_HANDLE; // Start/end of the scene pass, per frame in flight
+        uint64_t timestampMask = ~0ull; // Only timestampValidBits of each timestamp mean anything
+        std::vector<bool> frameTimestamped; // Whether a frame slot has timestamps to read back
+        std::vector<float> frameScales; // Scale each frame slot was last rendered at
 
         void initWindow() {
             // Initialize glfw library
@@ -220,7 +2286,12 @@ class HelloTriangleApplication {
             appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
             appInfo.pEngineName = "No Engine";
             appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            appInfo.apiVersion = VK_API_VERSION_1_0;
+
+            // 1.3 where the loader has it. What the device actually gets is still capped
+            // by its own version, and on anything older than 1.2 the scheduler falls
+            // back to the timeline extension or fences.
+            apiVersion = std::min(getInstanceVersion(), VK_API_VERSION_1_3);
+            appInfo.apiVersion = apiVersion;
 
             VkInstanceCreateInfo createInfo{}; // object metadata
             createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -246,7 +2317,7 @@ class HelloTriangleApplication {
             createInfo.ppEnabledExtensionNames = extensions.data();
 
             // Initialize the instance
-            VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+            VkResult result = vkCreateInstance(&createInfo, hostAllocator.callbacks(AllocationTag::Instance), &instance);
 
             // See if the instance was successfully created
             if (result != VK_SUCCESS) {
@@ -258,6 +2329,10 @@ class HelloTriangleApplication {
 
         // creates vulkan instance
         void initVulkan() {
+            captureSettings = captureSettingsFromEnvironment();
+            resolutionSettings = resolutionSettingsFromEnvironment();
+            resolutionHistoryFile = resolutionHistoryFileFromEnvironment();
+
             createInstance();
             setupDebugMessenger();
             createSurface();
@@ -265,10 +2340,239 @@ class HelloTriangleApplication {
             createLogicalDevice();
             createSwapChain();
             createImageViews();
+            setupDynamicResolution();
+            createRenderPass();
+            createDescriptorSetLayout();
             createGraphicsPipeline();
+            createFramebuffers();
+            createCommandPool();
+            createCommandBuffers();
+            createSyncObjects();
+            createUniformAllocator();
+            createFrameCapture();
+
+            // Anything allocated from here on is per-frame churn
+            mainLoopStartCounts = hostAllocator.counts();
+        }
+
+        // Single color attachment pass for the scene. Goes straight to the swap
+        // chain image normally, with dynamic resolution it's left ready to be
+        // scaled into it instead.
+        void createRenderPass() {
+            VkAttachmentDescription colorAttachment{};
+            colorAttachment.format = swapChainImageFormat;
+            colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // cleared every frame anyway
+            colorAttachment.finalLayout = dynamicResolution ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+            VkAttachmentReference colorAttachmentRef{};
+            colorAttachmentRef.attachment = 0;
+            colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+            VkSubpassDescription subpass{};
+            subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpass.colorAttachmentCount = 1;
+            subpass.pColorAttachments = &colorAttachmentRef;
+
+            // Straight to the swap chain, the acquire semaphore is waited on at
+            // COLOR_ATTACHMENT_OUTPUT so the layout transition has to wait there too.
+            // Offscreen, each frame in flight has its own target that the CPU only
+            // reuses once that frame's last submit is done, so nothing earlier
+            // needs waiting for. In particular not the previous frame's upscale,
+            // which waits on image acquisition and would drag vsync into the
+            // scene pass and its timestamps.
+            VkSubpassDependency dependencies[2]{};
+            dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+            dependencies[0].dstSubpass = 0;
+            dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[0].srcAccessMask = 0;
+            dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+            // Don't scale (or capture) out of the target until this frame is done drawing
+
+            dependencies[1].srcSubpass = 0;
+            dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            VkRenderPassCreateInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+            renderPassInfo.attachmentCount = 1;
+            renderPassInfo.pAttachments = &colorAttachment;
+            renderPassInfo.subpassCount = 1;
+            renderPassInfo.pSubpasses = &subpass;
+            bool transferAfter = dynamicResolution || captureSettings.format != CaptureFormat::None;
+            renderPassInfo.dependencyCount = transferAfter ? 2 : 1;
+            renderPassInfo.pDependencies = dependencies;
+
+            if (vkCreateRenderPass(device, &renderPassInfo, hostAllocator.callbacks(AllocationTag::RenderPass), &renderPass) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create render pass!");
+            }
+        }
+
+        // Scene targets: the swap chain images themselves, or with dynamic
+        // resolution an offscreen image per frame in flight
+        void createFramebuffers() {
+            renderExtent = swapChainExtent;
+
+            if (!dynamicResolution) {
+                swapChainFramebuffers.resize(swapChainImageViews.size());
+                for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+                    VkFramebufferCreateInfo framebufferInfo{};
+                    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+                    framebufferInfo.renderPass = renderPass;
+                    framebufferInfo.attachmentCount = 1;
+                    framebufferInfo.pAttachments = &swapChainImageViews[i];
+                    framebufferInfo.width = swapChainExtent.width;
+                    framebufferInfo.height = swapChainExtent.height;
+                    framebufferInfo.layers = 1;
+
+                    if (vkCreateFramebuffer(device, &framebufferInfo, hostAllocator.callbacks(AllocationTag::Framebuffer), &swapChainFramebuffers[i]) != VK_SUCCESS) {
+                        throw std::runtime_error("failed to create framebuffer!");
+                    }
+                }
+                return;
+            }
+
+            offscreenImages.resize(MAX_FRAMES_IN_FLIGHT);
+            offscreenImageMemories.resize(MAX_FRAMES_IN_FLIGHT);
+            offscreenImageViews.resize(MAX_FRAMES_IN_FLIGHT);
+            offscreenFramebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                createOffscreenTarget(i);
+            }
+        }
+
+        // Full swap chain sized target, only the top left renderExtent of it gets used
+        void createOffscreenTarget(size_t frame) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = swapChainImageFormat; // same format so full resolution frames are a plain copy
+            imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            if (vkCreateImage(device, &imageInfo, hostAllocator.callbacks(AllocationTag::Image), &offscreenImages[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create offscreen image!");
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(device, offscreenImages[frame], &memRequirements);
+
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = memRequirements.size;
+            allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            if (vkAllocateMemory(device, &allocInfo, hostAllocator.callbacks(AllocationTag::DeviceMemory), &offscreenImageMemories[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate offscreen image memory!");
+            }
+
+            vkBindImageMemory(device, offscreenImages[frame], offscreenImageMemories[frame], 0);
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = offscreenImages[frame];
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = swapChainImageFormat;
+            viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            viewInfo.subresourceRange.baseMipLevel = 0;
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.baseArrayLayer = 0;
+            viewInfo.subresourceRange.layerCount = 1;
+
+            if (vkCreateImageView(device, &viewInfo, hostAllocator.callbacks(AllocationTag::ImageView), &offscreenImageViews[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create offscreen image view!");
+            }
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &offscreenImageViews[frame];
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, hostAllocator.callbacks(AllocationTag::Framebuffer), &offscreenFramebuffers[frame]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create offscreen framebuffer!");
+            }
+        }
+
+        // Dynamic resolution needs GPU timestamps to measure with and a linear
+        // blit to scale with. Without them we just stay at full resolution.
+        void setupDynamicResolution() {
+            if (!resolutionSettings.has_value()) return;
+
+            QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+            uint32_t timestampValidBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+            if (timestampValidBits == 0) {
+                std::cerr << "graphics queue has no timestamps, dynamic resolution disabled" << std::endl;
+                return;
+            }
+
+            VkFormatProperties formatProperties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainImageFormat, &formatProperties);
+            VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+            if ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures) {
+                std::cerr << "swap chain format can't be linearly blitted, dynamic resolution disabled" << std::endl;
+                return;
+            }
+
+            timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT * 2;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, hostAllocator.callbacks(AllocationTag::QueryPool), &timestampQueryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timestamp query pool!");
+            }
+
+            frameTimestamped.assign(MAX_FRAMES_IN_FLIGHT, false);
+            frameScales.assign(MAX_FRAMES_IN_FLIGHT, 1.0f);
+            resolutionController.setSettings(resolutionSettings.value());
+            dynamicResolution = true;
         }
 
         // Initializes the graphics pipeline
+        // One dynamic uniform buffer, the offset into it is given per draw
+        void createDescriptorSetLayout() {
+            VkDescriptorSetLayoutBinding uniformBinding{};
+            uniformBinding.binding = 0;
+            uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            uniformBinding.descriptorCount = 1;
+            uniformBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = 1;
+            layoutInfo.pBindings = &uniformBinding;
+
+            if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostAllocator.callbacks(AllocationTag::DescriptorSetLayout), &uniformSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor set layout!");
+            }
+        }
+
         void createGraphicsPipeline() {
             auto vertShaderCode = readFile("shaders/vert.spv");
             auto fragShaderCode = readFile("shaders/frag.spv");
@@ -295,9 +2599,92 @@ class HelloTriangleApplication {
 
             VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
+            // No vertex buffers, the vertex shader has the triangle hardcoded
+            VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+            vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+            vertexInputInfo.vertexBindingDescriptionCount = 0;
+            vertexInputInfo.vertexAttributeDescriptionCount = 0;
+
+            VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+            inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+            inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+            inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+            // Viewport and scissor are set while recording, they follow renderExtent
+            std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+            VkPipelineDynamicStateCreateInfo dynamicState{};
+            dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+            dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+            dynamicState.pDynamicStates = dynamicStates.data();
+
+            VkPipelineViewportStateCreateInfo viewportState{};
+            viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+            viewportState.viewportCount = 1;
+            viewportState.scissorCount = 1;
+
+            VkPipelineRasterizationStateCreateInfo rasterizer{};
+            rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+            rasterizer.depthClampEnable = VK_FALSE;
+            rasterizer.rasterizerDiscardEnable = VK_FALSE;
+            rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+            rasterizer.lineWidth = 1.0f;
+            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+            rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+            rasterizer.depthBiasEnable = VK_FALSE;
+
+            VkPipelineMultisampleStateCreateInfo multisampling{};
+            multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+            multisampling.sampleShadingEnable = VK_FALSE;
+            multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+            // Opaque, write all channels
+            VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+            colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                                  VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+            colorBlendAttachment.blendEnable = VK_FALSE;
+
+            VkPipelineColorBlendStateCreateInfo colorBlending{};
+            colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+            colorBlending.logicOpEnable = VK_FALSE;
+            colorBlending.attachmentCount = 1;
+            colorBlending.pAttachments = &colorBlendAttachment;
+
+            // Per-draw uniforms in set 0, the current shaders don't read them yet
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &uniformSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 0;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostAllocator.callbacks(AllocationTag::PipelineLayout), &pipelineLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline layout!");
+            }
+
+            VkGraphicsPipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            pipelineInfo.stageCount = 2;
+            pipelineInfo.pStages = shaderStages;
+            pipelineInfo.pVertexInputState = &vertexInputInfo;
+            pipelineInfo.pInputAssemblyState = &inputAssembly;
+            pipelineInfo.pViewportState = &viewportState;
+            pipelineInfo.pRasterizationState = &rasterizer;
+            pipelineInfo.pMultisampleState = &multisampling;
+            pipelineInfo.pColorBlendState = &colorBlending;
+            pipelineInfo.pDynamicState = &dynamicState;
+            pipelineInfo.layout = pipelineLayout;
+            pipelineInfo.renderPass = renderPass;
+            pipelineInfo.subpass = 0;
+
+            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, hostAllocator.callbacks(AllocationTag::Pipeline), &graphicsPipeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+
+            trianglePipeline = drawQueue.addPipeline(graphicsPipeline, pipelineLayout);
+            triangleMesh = drawQueue.addMesh(3, 0);
+
             // Destroy shader modules
-            vkDestroyShaderModule(device, fragShaderModule, nullptr);
-            vkDestroyShaderModule(device, vertShaderModule, nullptr);
+            vkDestroyShaderModule(device, fragShaderModule, hostAllocator.callbacks(AllocationTag::ShaderModule));
+            vkDestroyShaderModule(device, vertShaderModule, hostAllocator.callbacks(AllocationTag::ShaderModule));
         }
 
         // Reads a binary file into a byte array
@@ -328,7 +2715,7 @@ class HelloTriangleApplication {
 
 
             VkShaderModule shaderModule;
-            if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+            if (vkCreateShaderModule(device, &createInfo, hostAllocator.callbacks(AllocationTag::ShaderModule), &shaderModule) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create shader module!");
             }
 
@@ -361,7 +2748,7 @@ class HelloTriangleApplication {
                 createInfo.subresourceRange.baseArrayLayer = 0;
                 createInfo.subresourceRange.layerCount = 1; // Multiple layers for 3D stereoscopic application (VR)
 
-                if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
+                if (vkCreateImageView(device, &createInfo, hostAllocator.callbacks(AllocationTag::ImageView), &swapChainImageViews[i]) != VK_SUCCESS) {
                     throw std::runtime_error("failed to create image views!");
                 }
             }
@@ -390,7 +2777,26 @@ class HelloTriangleApplication {
             createInfo.imageColorSpace = surfaceFormat.colorSpace;
             createInfo.imageExtent = extent;
             createInfo.imageArrayLayers = 1; // 1 unless developing stereoscopic 3D application
-            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // render directly to images (no postprocessing)
+            createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+            // Dynamic resolution renders offscreen and scales into the swap chain image
+            if (resolutionSettings.has_value()) {
+                if (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+                    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+                }
+                else {
+                    std::cerr << "swap chain images can't be copied to, dynamic resolution disabled" << std::endl;
+                    resolutionSettings.reset();
+                }
+            }
+
+            // Capturing copies the presented images out, so they need to be transfer sources
+            if (captureSettings.format != CaptureFormat::None) {
+                if (!(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+                    throw std::runtime_error("swap chain images can't be copied from, frame capture not supported!");
+                }
+                createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            }
 
             QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
             uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -425,7 +2831,7 @@ class HelloTriangleApplication {
             createInfo.oldSwapchain = VK_NULL_HANDLE;
 
             // Create this mf gyat damn swap chain
-            if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+            if (vkCreateSwapchainKHR(device, &createInfo, hostAllocator.callbacks(AllocationTag::Swapchain), &swapChain) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create swap chain!");
             }
 
@@ -441,7 +2847,7 @@ class HelloTriangleApplication {
 
         // Uses GLFW to init platform-agnostic surface
         void createSurface() {
-            if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+            if (glfwCreateWindowSurface(instance, window, hostAllocator.callbacks(AllocationTag::Surface), &surface) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create window surface!");
             }
         }
@@ -507,21 +2913,48 @@ class HelloTriangleApplication {
                 queueCreateInfos.push_back(queueCreateInfo);
             }
 
-            // Set of devices features we wanna use (none for now)
-            VkPhysicalDeviceFeatures deviceFeatures{};
+            VkPhysicalDeviceFeatures2 deviceFeatures{};
+            deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            std::vector<const char*> extensions(deviceExtensions.begin(), deviceExtensions.end());
+
+            // Timeline semaphores for the submission scheduler, if the device has them
+            timelineSupport = checkTimelineSemaphoreSupport(physicalDevice);
+
+            VkPhysicalDeviceVulkan12Features features12{};
+            features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+            timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+            if (timelineSupport == TimelineSupport::Core) {
+                features12.timelineSemaphore = VK_TRUE;
+                deviceFeatures.pNext = &features12;
+            }
+            else if (timelineSupport == TimelineSupport::Extension) {
+                timelineFeatures.timelineSemaphore = VK_TRUE;
+                deviceFeatures.pNext = &timelineFeatures;
+                extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            }
 
             // Logical device creation information
             VkDeviceCreateInfo createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()); // Graphics + Presentation queue
             createInfo.pQueueCreateInfos = queueCreateInfos.data();
-            createInfo.pEnabledFeatures = &deviceFeatures;
+
+            // VkPhysicalDeviceFeatures2 in pNext needs 1.1, which both timeline paths have
+            if (timelineSupport != TimelineSupport::None) {
+                createInfo.pNext = &deviceFeatures;
+                createInfo.pEnabledFeatures = nullptr;
+            }
+            else {
+                createInfo.pEnabledFeatures = &deviceFeatures.features;
+            }
 
 
             // Device specific extensions and validation layers
             // ================================================
-            createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+            createInfo.ppEnabledExtensionNames = extensions.data();
 
             // Get number of validation layers
             if (enableValidationLayers) {
@@ -533,10 +2966,14 @@ class HelloTriangleApplication {
             }
 
             // Don't need to worry about any device specific extensions (for now)
-            if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+            if (vkCreateDevice(physicalDevice, &createInfo, hostAllocator.callbacks(AllocationTag::Device), &device) != VK_SUCCESS) {
                 throw std::runtime_error("Failed to create logical device!!!");
             }
 
+            const char *timelineNames[] = {"fences", "VK_KHR_timeline_semaphore", "timeline semaphores"};
+            std::cout << "Vulkan " << VK_API_VERSION_MAJOR(apiVersion) << "." << VK_API_VERSION_MINOR(apiVersion)
+                      << ", scheduler on " << timelineNames[static_cast<int>(timelineSupport)] << std::endl;
+
             // Get a handle to the device queue(s)
             vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
             vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
@@ -573,9 +3010,60 @@ class HelloTriangleApplication {
             // Need that swapchain extension
             if (!(deviceFeatures.geometryShader && indices.isComplete() && extensionsSupported && swapChainAdequate)) return 0;
 
+            // Scheduler runs on fences otherwise, so only a tie breaker
+            if (checkTimelineSemaphoreSupport(device) != TimelineSupport::None) {
+                score += 100;
+            }
+
             return score;
         }
 
+        // Timeline semaphores are core since 1.2 and an extension on 1.1, either
+        // way the feature bit still has to be there
+        TimelineSupport checkTimelineSemaphoreSupport(VkPhysicalDevice device) {
+            VkPhysicalDeviceProperties deviceProperties;
+            vkGetPhysicalDeviceProperties(device, &deviceProperties);
+            uint32_t version = std::min(apiVersion, deviceProperties.apiVersion);
+
+            if (version >= VK_API_VERSION_1_2) {
+                VkPhysicalDeviceVulkan12Features features12{};
+                features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+                VkPhysicalDeviceFeatures2 features{};
+                features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+                features.pNext = &features12;
+                vkGetPhysicalDeviceFeatures2(device, &features);
+
+                if (features12.timelineSemaphore) return TimelineSupport::Core;
+            }
+
+            // The extension leans on vkGetPhysicalDeviceFeatures2, core since 1.1
+            if (version >= VK_API_VERSION_1_1 && hasDeviceExtension(device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+                VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+                timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+                VkPhysicalDeviceFeatures2 features{};
+                features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+                features.pNext = &timelineFeatures;
+                vkGetPhysicalDeviceFeatures2(device, &features);
+
+                if (timelineFeatures.timelineSemaphore) return TimelineSupport::Extension;
+            }
+
+            return TimelineSupport::None;
+        }
+
+        bool hasDeviceExtension(VkPhysicalDevice device, const char *name) {
+            uint32_t extensionCount;
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+            for (const auto& extension : availableExtensions) {
+                if (std::strcmp(extension.extensionName, name) == 0) return true;
+            }
+            return false;
+        }
+
         bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
             // Get device extension count
             uint32_t extensionCount;
@@ -603,7 +3091,7 @@ class HelloTriangleApplication {
             createInfo.pfnUserCallback = debugCallback;
 
             // Load the debug utils messenger, throw a fit if that shit doesn't exist
-            if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
+            if (CreateDebugUtilsMessengerEXT(instance, &createInfo, hostAllocator.callbacks(AllocationTag::DebugMessenger), &debugMessenger) != VK_SUCCESS) {
                 throw std::runtime_error("failed to set up debug messenger!");
             }
         }
@@ -715,34 +3203,398 @@ class HelloTriangleApplication {
             return indices;
         }
 
+        // Command buffers get reset and re-recorded every frame
+        void createCommandPool() {
+            QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+            if (vkCreateCommandPool(device, &poolInfo, hostAllocator.callbacks(AllocationTag::CommandPool), &commandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create command pool!");
+            }
+        }
+
+        void createCommandBuffers() {
+            commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+        }
+
+        // The timeline scheduler tells the CPU when a frame's resources are free
+        // again, binary semaphores are only left for talking to the swap chain
+        void createSyncObjects() {
+            scheduler.create(device, hostAllocator, timelineSupport);
+            graphicsTimeline = scheduler.addQueue(graphicsQueue);
+            captureTimeline = scheduler.addHostTimeline();
+
+            // Value 0 is already complete, so the first wait on each frame is free
+            frameSubmits.assign(MAX_FRAMES_IN_FLIGHT, {graphicsTimeline, 0});
+
+            // Acquire semaphores are free again once the frame's submit is done, but
+            // a present semaphore is only known to be consumed once its image is
+            // acquired again, so those go per swap chain image
+            imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+            renderFinishedSemaphores.resize(swapChainImages.size());
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.callbacks(AllocationTag::Semaphore), &imageAvailableSemaphores[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create synchronization objects for a frame!");
+                }
+            }
+
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.callbacks(AllocationTag::Semaphore), &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create synchronization objects for a swap chain image!");
+                }
+            }
+        }
+
+        void createUniformAllocator() {
+            uniformAllocator.create(device, physicalDevice, physicalDeviceProperties.limits,
+                UNIFORM_BYTES_PER_FRAME, MAX_FRAMES_IN_FLIGHT, hostAllocator);
+
+            VkDescriptorPoolSize poolSize{};
+            poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            poolSize.descriptorCount = 1;
+
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator.callbacks(AllocationTag::DescriptorPool), &descriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor pool!");
+            }
+
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = descriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &uniformSetLayout;
+
+            if (vkAllocateDescriptorSets(device, &allocInfo, &uniformSet) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate uniform descriptor set!");
+            }
+
+            // Written once, every frame and draw just picks a different dynamic offset
+            VkDescriptorBufferInfo bufferInfo = uniformAllocator.descriptorInfo(sizeof(ObjectUniforms));
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = uniformSet;
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+            triangleMaterial = drawQueue.addMaterial(uniformSet, 0, true);
+        }
+
+        void createFrameCapture() {
+            if (captureSettings.format == CaptureFormat::None) return;
+
+            frameCapture.create(device, physicalDevice, swapChainExtent, swapChainImageFormat, captureSettings, hostAllocator);
+        }
+
+        void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording command buffer!");
+            }
+
+            // Time the scene pass for the resolution controller
+            if (dynamicResolution) {
+                vkCmdResetQueryPool(commandBuffer, timestampQueryPool, currentFrame * 2, 2);
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * 2);
+            }
+
+            // Scene goes into the swap chain image, or the top left renderExtent of this frame's offscreen target
+            VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = dynamicResolution ? offscreenFramebuffers[currentFrame] : swapChainFramebuffers[imageIndex];
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = renderExtent;
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
+
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            VkViewport viewport{};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = static_cast<float>(renderExtent.width);
+            viewport.height = static_cast<float>(renderExtent.height);
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(commandBuffer, 0, 1, &renderPassInfo.renderArea);
+
+            drawQueue.record(commandBuffer);
+            vkCmdEndRenderPass(commandBuffer);
+
+            if (dynamicResolution) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentFrame * 2 + 1);
+                frameTimestamped[currentFrame] = true;
+                frameScales[currentFrame] = resolutionController.scale();
+
+                recordUpscale(commandBuffer, imageIndex);
+
+                // Copying the frame out also leaves it ready to present
+                bool captured = captureSettings.format != CaptureFormat::None &&
+                    frameCapture.recordCopy(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, frameNumber);
+
+                if (!captured) {
+                    recordImageBarrier(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+                }
+            }
+            else if (captureSettings.format != CaptureFormat::None) {
+                // The render pass already left the image ready to present (and its
+                // outgoing dependency covers transfers), the copy puts it back that way
+                frameCapture.recordCopy(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, 0, frameNumber);
+            }
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record command buffer!");
+            }
+        }
+
+        // Copy (full resolution) or blit this frame's offscreen target into the
+        // swap chain image, leaving it in TRANSFER_DST
+        void recordUpscale(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+            recordImageBarrier(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+            VkImageSubresourceLayers subresource{};
+            subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            subresource.mipLevel = 0;
+            subresource.baseArrayLayer = 0;
+            subresource.layerCount = 1;
+
+            if (renderExtent.width == swapChainExtent.width && renderExtent.height == swapChainExtent.height) {
+                // Full resolution, a plain copy doesn't need any blit support from the format
+                VkImageCopy region{};
+                region.srcSubresource = subresource;
+                region.dstSubresource = subresource;
+                region.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+
+                vkCmdCopyImage(commandBuffer, offscreenImages[currentFrame], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            }
+            else {
+                VkImageBlit region{};
+                region.srcSubresource = subresource;
+                region.srcOffsets[1] = {static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1};
+                region.dstSubresource = subresource;
+                region.dstOffsets[1] = {static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1};
+
+                vkCmdBlitImage(commandBuffer, offscreenImages[currentFrame], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+            }
+        }
+
+        // Read back the scene time of the frame that last used this slot and
+        // let the controller pick the resolution for the one about to be recorded
+        void updateRenderExtent() {
+            if (frameTimestamped[currentFrame]) {
+                uint64_t timestamps[2];
+                VkResult result = vkGetQueryPoolResults(device, timestampQueryPool, currentFrame * 2, 2,
+                    sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+                if (result == VK_SUCCESS) {
+                    uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+                    float gpuMs = static_cast<float>(ticks * static_cast<double>(physicalDeviceProperties.limits.timestampPeriod) / 1e6);
+                    resolutionController.update(gpuMs, frameScales[currentFrame]);
+                }
+            }
+
+            float scale = resolutionController.scale();
+            renderExtent.width = std::clamp(static_cast<uint32_t>(swapChainExtent.width * scale + 0.5f), 1u, swapChainExtent.width);
+            renderExtent.height = std::clamp(static_cast<uint32_t>(swapChainExtent.height * scale + 0.5f), 1u, swapChainExtent.height);
+        }
+
+        // Hand this frame's draws to the draw queue
+        void submitScene() {
+            ObjectUniforms uniforms{};
+            for (int i = 0; i < 4; i++) {
+                uniforms.model[i][i] = 1.0f;
+            }
+
+            DrawPacket triangle;
+            triangle.pipeline = trianglePipeline;
+            triangle.material = triangleMaterial;
+            triangle.mesh = triangleMesh;
+            triangle.dynamicOffset = uniformAllocator.push(uniforms).dynamicOffset;
+            drawQueue.submit(triangle);
+        }
+
+        void drawFrame() {
+            // Wait until the GPU is done with the last use of this frame's resources
+            scheduler.wait(frameSubmits[currentFrame]);
+
+            // ...which means this frame's uniform data can be overwritten
+            uniformAllocator.beginFrame(currentFrame);
+
+            // ...and its timestamps are in
+            if (dynamicResolution) {
+                updateRenderExtent();
+            }
+
+            // Pick up everything else the GPU has finished since last frame
+            scheduler.poll();
+
+            uint32_t imageIndex;
+            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
+
+            drawQueue.clear();
+            submitScene();
+            drawQueue.sort();
+
+            vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+            recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+
+            SubmissionScheduler::GpuJob job;
+            job.pCommandBuffers = &commandBuffers[currentFrame];
+            job.commandBufferCount = 1;
+            job.waitBinary = imageAvailableSemaphores[currentFrame];
+            // Swap chain image is first touched by the upscale, or by the scene pass itself
+            job.waitBinaryStage = dynamicResolution ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            job.signalBinary = renderFinishedSemaphores[imageIndex];
+
+            frameSubmits[currentFrame] = scheduler.submit(graphicsTimeline, job);
+
+            // Readback buffers go to the encoder once the copy into them is done
+            if (captureSettings.format != CaptureFormat::None) {
+                uint64_t value = frameSubmits[currentFrame].value;
+                frameCapture.submitted(value);
+                scheduler.scheduleHost(captureTimeline, {frameSubmits[currentFrame]}, [this, value] { frameCapture.retire(value); });
+            }
+
+            VkPresentInfoKHR presentInfo{};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = &swapChain;
+            presentInfo.pImageIndices = &imageIndex;
+
+            vkQueuePresentKHR(presentQueue, &presentInfo);
+
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            frameNumber++;
+        }
+
         // main loop beep boop
         void mainLoop() {
             while(!glfwWindowShouldClose(window)) {
                 glfwPollEvents();
+                drawFrame();
             }
+
+            // Don't start destroying things the GPU is still using. This covers
+            // presents too, which the scheduler doesn't track, and poll() then
+            // runs whatever was waiting on the last frames.
+            vkDeviceWaitIdle(device);
+            scheduler.poll();
+
+            hostAllocator.printSince(std::cout, "main loop", mainLoopStartCounts, frameNumber);
         }
 
 
         // Destroy all your shit
         void cleanup() {
+            if (dynamicResolution) {
+                resolutionController.printStats(std::cout);
+                if (!resolutionHistoryFile.empty()) {
+                    std::ofstream history(resolutionHistoryFile);
+                    resolutionController.writeHistory(history);
+                    if (!history) {
+                        std::cerr << "failed to write dynamic resolution history to " << resolutionHistoryFile << std::endl;
+                    }
+                }
+                vkDestroyQueryPool(device, timestampQueryPool, hostAllocator.callbacks(AllocationTag::QueryPool));
+            }
+
+            for (size_t i = 0; i < offscreenFramebuffers.size(); i++) {
+                vkDestroyFramebuffer(device, offscreenFramebuffers[i], hostAllocator.callbacks(AllocationTag::Framebuffer));
+                vkDestroyImageView(device, offscreenImageViews[i], hostAllocator.callbacks(AllocationTag::ImageView));
+                vkDestroyImage(device, offscreenImages[i], hostAllocator.callbacks(AllocationTag::Image));
+                vkFreeMemory(device, offscreenImageMemories[i], hostAllocator.callbacks(AllocationTag::DeviceMemory));
+            }
+            for (VkFramebuffer framebuffer : swapChainFramebuffers) {
+                vkDestroyFramebuffer(device, framebuffer, hostAllocator.callbacks(AllocationTag::Framebuffer));
+            }
+            drawQueue.printStats(std::cout);
+            vkDestroyPipeline(device, graphicsPipeline, hostAllocator.callbacks(AllocationTag::Pipeline));
+            vkDestroyPipelineLayout(device, pipelineLayout, hostAllocator.callbacks(AllocationTag::PipelineLayout));
+            vkDestroyRenderPass(device, renderPass, hostAllocator.callbacks(AllocationTag::RenderPass));
+
+            frameCapture.destroy();
+            vkDestroyDescriptorPool(device, descriptorPool, hostAllocator.callbacks(AllocationTag::DescriptorPool));
+            vkDestroyDescriptorSetLayout(device, uniformSetLayout, hostAllocator.callbacks(AllocationTag::DescriptorSetLayout));
+            uniformAllocator.destroy();
+
+            for (VkSemaphore semaphore : renderFinishedSemaphores) {
+                vkDestroySemaphore(device, semaphore, hostAllocator.callbacks(AllocationTag::Semaphore));
+            }
+            for (VkSemaphore semaphore : imageAvailableSemaphores) {
+                vkDestroySemaphore(device, semaphore, hostAllocator.callbacks(AllocationTag::Semaphore));
+            }
+
+            scheduler.destroy();
+
+            vkDestroyCommandPool(device, commandPool, hostAllocator.callbacks(AllocationTag::CommandPool));
+
             for (auto imageView : swapChainImageViews) {
-                vkDestroyImageView(device, imageView, nullptr);
+                vkDestroyImageView(device, imageView, hostAllocator.callbacks(AllocationTag::ImageView));
             }
 
-            vkDestroySwapchainKHR(device, swapChain, nullptr);
-            vkDestroyDevice(device, nullptr);
+            vkDestroySwapchainKHR(device, swapChain, hostAllocator.callbacks(AllocationTag::Swapchain));
+            vkDestroyDevice(device, hostAllocator.callbacks(AllocationTag::Device));
 
             // If we're using validation layers, need to destroy the debug messenger
             if (enableValidationLayers) {
-                DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+                DestroyDebugUtilsMessengerEXT(instance, debugMessenger, hostAllocator.callbacks(AllocationTag::DebugMessenger));
                 int a=0;
             }
 
-            vkDestroySurfaceKHR(instance, surface, nullptr);
-            vkDestroyInstance(instance, nullptr);
+            vkDestroySurfaceKHR(instance, surface, hostAllocator.callbacks(AllocationTag::Surface));
+            vkDestroyInstance(instance, hostAllocator.callbacks(AllocationTag::Instance));
             glfwDestroyWindow(window);
             glfwTerminate();
 
+            // Everything has been handed back by now, so live bytes should read 0
+            hostAllocator.printStats(std::cout);
+
         }
 };
 